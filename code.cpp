@@ -1,6 +1,7 @@
 #include "src/TrainSystem.hpp"
 #include "src/UserSystem.hpp"
 #include "src/utils.hpp"
+#include "src/GroupCommit.hpp"
 using std::cout;
 using std::string;
 using std::stringstream;
@@ -10,10 +11,20 @@ int main() {
   std::cin.tie(nullptr);
   //freopen("testcases/22.in", "r", stdin);
   //freopen("testcases/22(1).out", "w", stdout);
-  UserSystem userSystem("users_data");
-  TrainSystem trainSystem("trains_data", "orders_data", "pending_queue_data", "station_train_map_data");
+  //日志要在打开数据文件之前完成恢复，并且比两个系统活得更久
+  WriteAheadLog wal("wal_log");
+  UserSystem userSystem("users_data", &wal);
+  TrainSystem trainSystem("trains_data", "orders_data", "pending_queue_data", "station_train_map_data", &wal);
+  //后台写回脏页的速率(页/秒)由环境变量TICKET_FLUSH_RATE决定，0表示关闭
+  const char* flush_rate = std::getenv("TICKET_FLUSH_RATE");
+  int pages_per_second = flush_rate ? std::atoi(flush_rate) : 2000;
+  userSystem.start_writer(pages_per_second);
+  trainSystem.start_writer(pages_per_second);
+  //命令的输出在所在的一批提交落盘之后才放出
+  GroupCommit committer(wal, cout, durabilityFromEnv());
   string s;
-  while (getline(std::cin, s)) {
+  //每条命令执行完之后提交它的修改，continue也会先走到这里
+  for (; getline(std::cin, s); committer.commit()) {
     string prefix = get_prefix(s);
     string command = remove_prefix(s);
     cout << prefix << ' ';
@@ -23,6 +34,9 @@ int main() {
       cout << "bye" << endl;
       userSystem.exit();
       trainSystem.upload_timestamp();
+      committer.commit();
+      committer.sync();
+      wal.checkpoint();
       return 0;
     }
 
@@ -5,11 +5,17 @@
 #include <cmath>
 #include <string>
 #include <cstring>
+#include <cstddef>
 #include <fstream>
 #include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <cassert>
 #include "MemoryRiver.hpp"
 #include "vector.hpp"
 #include "map.hpp"
+#include "BufferPool.hpp"
+#include "RecordHeap.hpp"
 
 using std::string;
 using std::fstream;
@@ -17,56 +23,77 @@ using std::ios;
 using std::cout;
 using std::endl;
 
-const int STR_LEN = 65;
+//Key最多存STR_LEN - 1个字节，站名最长30字节(10个汉字)，用户名和车次不超过20字节
+const int STR_LEN = 31;
 
 /********************************************************************/
 //若干结构体
+//把p开始的8个字节按大端序拼成整数，整数的大小顺序与这8个字节memcmp的顺序一致
+inline unsigned long long loadPrefix(const char* p) {
+  unsigned long long x;
+  std::memcpy(&x, p, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  x = __builtin_bswap64(x);
+#endif
+  return x;
+}
+
 /*
-Key结构体
+Key结构体：带长度前缀的字符串，data仍以'\0'结尾
+比较时先memcmp公共长度再比较长度，与strcmp的顺序一致
+data在len之后总是补0，所以前8个字节可以当作一个整数先比，相同时才比较剩下的部分
 */
 struct Key {
+  unsigned char len;
   char data[STR_LEN];
 
-  Key() {
+  Key() : len(0) {
     std::memset(data, 0, STR_LEN);
   }
 
+  //截短会让前缀相同的两个key相等，超长直接报错，调用者要先检查长度(见utils.hpp中的fits_key)
   Key(const char* str) {
-    size_t len = strlen(str) < STR_LEN - 1 ? strlen(str) : STR_LEN - 1;
-    std::memcpy(data, str, len);
-    data[len] = '\0';
+    size_t n = strlen(str);
+    assert(n < STR_LEN && "Key is longer than STR_LEN - 1 bytes");
+    if (n > STR_LEN - 1) n = STR_LEN - 1;
+    len = n;
+    std::memcpy(data, str, n);
+    std::memset(data + n, 0, STR_LEN - n);
   }
 
-  Key& operator=(const Key& other) {
-    if (this != &other) {
-      // 直接拷贝整个数组，避免strlen开销
-      std::memcpy(data, other.data, STR_LEN);
-    }
-    return *this;
+  static int compare(const Key& a, const Key& b) {
+    unsigned long long pa = loadPrefix(a.data), pb = loadPrefix(b.data);
+    if (pa != pb) return pa < pb ? -1 : 1;
+    int n = a.len < b.len ? a.len : b.len;
+    if (n > 8) {
+      int res = std::memcmp(a.data + 8, b.data + 8, n - 8);
+      if (res != 0) return res;
+    }
+    return (int)a.len - (int)b.len;
   }
 
   bool operator<(const Key& other) const {
-    return std::strcmp(data, other.data) < 0;
+    return compare(*this, other) < 0;
   }
 
   bool operator>(const Key& other) const {
-    return std::strcmp(data, other.data) > 0;
+    return compare(*this, other) > 0;
   }
 
   bool operator<=(const Key& other) const {
-    return std::strcmp(data, other.data) <= 0;
+    return compare(*this, other) <= 0;
   }
 
   bool operator>=(const Key& other) const {
-    return std::strcmp(data, other.data) >= 0;
+    return compare(*this, other) >= 0;
   }
 
   bool operator==(const Key& other) const {
-    return std::strcmp(data, other.data) == 0;
+    return len == other.len && std::memcmp(data, other.data, len) == 0;
   }
 
   bool operator!=(const Key& other) const {
-    return std::strcmp(data, other.data) != 0;
+    return !(*this == other);
   }
 
   friend std::ostream& operator<<(std::ostream& os, const Key& key) {
@@ -77,48 +104,136 @@ struct Key {
   friend std::istream& operator>>(std::istream& is, Key& key) {
     std::string temp;
     is >> temp;
-    size_t len = temp.size() < STR_LEN - 1 ? temp.size() : STR_LEN - 1;
-    std::memcpy(key.data, temp.data(), len);
-    key.data[len] = '\0';
+    key = Key(temp.c_str());
     return is;
   }
 };
 
 /*
-键值对结构体
+定长字节串key：先按长度再按memcmp比较，只适合按key精确查找、不需要字典序的索引
 */
-template<class T>
+template<int N>
+struct FixedKey {
+  unsigned char len;
+  char data[N + 1];
+
+  FixedKey() : len(0) {
+    std::memset(data, 0, N + 1);
+  }
+
+  FixedKey(const char* str) {
+    size_t n = strlen(str);
+    assert(n <= N && "FixedKey is longer than N bytes");
+    if (n > N) n = N;
+    len = n;
+    std::memcpy(data, str, n);
+    std::memset(data + n, 0, N + 1 - n);
+  }
+
+  static int compare(const FixedKey& a, const FixedKey& b) {
+    if (a.len != b.len) return (int)a.len - (int)b.len;
+    if constexpr (N + 1 >= 8) {
+      unsigned long long pa = loadPrefix(a.data), pb = loadPrefix(b.data);
+      if (pa != pb) return pa < pb ? -1 : 1;
+      return a.len > 8 ? std::memcmp(a.data + 8, b.data + 8, a.len - 8) : 0;
+    }
+    return std::memcmp(a.data, b.data, a.len);
+  }
+
+  bool operator<(const FixedKey& other) const {
+    return compare(*this, other) < 0;
+  }
+  bool operator==(const FixedKey& other) const {
+    return compare(*this, other) == 0;
+  }
+  bool operator!=(const FixedKey& other) const {
+    return compare(*this, other) != 0;
+  }
+
+  friend std::ostream& operator<<(std::ostream& os, const FixedKey& key) {
+    os << key.data;
+    return os;
+  }
+};
+
+/*
+key的比较策略：compare返回负数、0、正数，BPlusTree中key之间的比较都经过这里
+默认使用K的operator<，自定义的key类型可以特化
+*/
+template<class K>
+struct KeyCompare {
+  static int compare(const K& a, const K& b) {
+    return a < b ? -1 : (b < a ? 1 : 0);
+  }
+};
+
+template<>
+struct KeyCompare<Key> {
+  static int compare(const Key& a, const Key& b) {
+    return Key::compare(a, b);
+  }
+};
+
+template<>
+struct KeyCompare<int> {
+  static int compare(int a, int b) {
+    return (a > b) - (a < b);
+  }
+};
+
+template<>
+struct KeyCompare<long long> {
+  static int compare(long long a, long long b) {
+    return (a > b) - (a < b);
+  }
+};
+
+template<int N>
+struct KeyCompare<FixedKey<N>> {
+  static int compare(const FixedKey<N>& a, const FixedKey<N>& b) {
+    return FixedKey<N>::compare(a, b);
+  }
+};
+
+/*
+键值对结构体：先按key比较，key相同再按value比较
+*/
+template<class T, class K = Key>
 struct KeyValue {
-  Key key;                          //存储键
+  K key;                            //存储键
   T value;                          //存储值
-  KeyValue<T>() = default;
-  KeyValue(const Key& _key, T _value) : key(_key), value(_value) {};
+  KeyValue() = default;
+  KeyValue(const K& _key, T _value) : key(_key), value(_value) {};
   KeyValue(const KeyValue&) = default;
   KeyValue& operator=(const KeyValue&) = default;
   KeyValue(KeyValue&&) noexcept = default;
   KeyValue& operator=(KeyValue&&) noexcept = default;
 
   bool operator < (const KeyValue& other) const {
-    if (key == other.key) return value < other.value;
-    return key < other.key;
+    int res = KeyCompare<K>::compare(key, other.key);
+    if (res == 0) return value < other.value;
+    return res < 0;
   }
   bool operator > (const KeyValue& other) const {
-    if (key == other.key) return value > other.value;
-    return key > other.key;
+    int res = KeyCompare<K>::compare(key, other.key);
+    if (res == 0) return value > other.value;
+    return res > 0;
   }
   bool operator <= (const KeyValue& other) const {
-    if (key == other.key) return value <= other.value;
-    return key < other.key;
+    int res = KeyCompare<K>::compare(key, other.key);
+    if (res == 0) return value <= other.value;
+    return res < 0;
   }
   bool operator >= (const KeyValue& other) const {
-    if (key == other.key) return value >= other.value;
-    return key > other.key;
+    int res = KeyCompare<K>::compare(key, other.key);
+    if (res == 0) return value >= other.value;
+    return res > 0;
   }
   bool operator == (const KeyValue& other) const {
-    return key == other.key && value == other.value;
+    return KeyCompare<K>::compare(key, other.key) == 0 && value == other.value;
   }
   bool operator != (const KeyValue& other) const {
-    return key != other.key || value != other.value;
+    return !(*this == other);
   }
   friend std::ostream& operator<<(std::ostream& os, const KeyValue& kv) {
     os << kv.key << " " << kv.value;
@@ -132,35 +247,48 @@ struct KeyValue {
 };
 
 /*
-Index节点结构体
+排序键：决定同一个key下各个value的先后次序，需要和T的比较运算结果一致
+默认就是value本身，较大的T应当特化成只包含参与比较的字段
+内部节点的分隔键和堆模式的叶子都只存排序键
+*/
+template<class T>
+struct SortKey {
+  using type = T;
+  static const T& get(const T& value) {
+    return value;
+  }
+};
+
+/*
+叶节点结构体：存放键值对，叶子之间用prev和next串成双向链表
 */
-template<class T, int SIZE>
-struct IndexNode {                  //把每个节点的元信息包含在节点之内
-  bool is_leaf;                     //是否叶节点
+template<class T, int SIZE, class K = Key>
+struct LeafNode {                   //把每个节点的元信息包含在节点之内
   int parent;
   int prev;
   int next;
-  KeyValue<T> keyvalues[SIZE + 5];  //存储键
-  size_t kv_num;                    //存储已经有的键的数量
-  int child_offset[SIZE + 5];       //存储数据在文件中的偏移量
+  int kv_num;                       //存储已经有的键的数量
+  KeyValue<T, K> keyvalues[SIZE + 5];  //存储键
   int offset;                       //节点的偏移量
 
-  IndexNode() : is_leaf(false), parent(-1), prev(-1), next(-1) {
-    for (int i = 0; i < SIZE + 5; i++) {
-      keyvalues[i] = KeyValue<T>();
-    }
-    for (int i = 0; i <= SIZE + 4; i++) {
-      child_offset[i] = -1;
-    }
-    offset = -1;
-    kv_num = 0;
-  };
-  IndexNode(bool _is_leaf, int _parent, int _prev, int _next, size_t _kv_num, int _offset) :
-  is_leaf(_is_leaf), parent(_parent), prev(_prev), next(_next), kv_num(_kv_num), offset(_offset) {
-    for (int i = 0; i < SIZE + 5; i++) {
-      keyvalues[i] = KeyValue<T>();
-    }
-    for (int i = 0; i <= SIZE + 4; i++) {
+  LeafNode() : parent(-1), prev(-1), next(-1), kv_num(0), offset(-1) {};
+};
+
+/*
+内部节点结构体：只存分隔键和子节点的偏移量，不存完整的value
+分隔键由key和value的排序键组成，足够区分同一个key下的不同value
+*/
+template<class S, int SIZE, class K = Key>
+struct InnerNode {
+  bool leaf_children;               //子节点是否是叶节点
+  int parent;                       //空闲节点用parent串成空闲链表
+  int kv_num;                       //分隔键的数量，子节点比它多一个
+  KeyValue<S, K> keys[SIZE + 5];    //分隔键
+  int child_offset[SIZE + 6];       //子节点的偏移量
+  int offset;                       //节点的偏移量
+
+  InnerNode() : leaf_children(false), parent(-1), kv_num(0), offset(-1) {
+    for (int i = 0; i < SIZE + 6; i++) {
       child_offset[i] = -1;
     }
   };
@@ -168,948 +296,1508 @@ struct IndexNode {                  //把每个节点的元信息包含在节点
 
 /*
 整棵树的元信息
+叶节点文件头依次存前五项，内部节点文件头存后两项
 */
 struct BPT_Meta {
   int root;                         //根节点的偏移量
   int total_num;                    //总的键值对个数
-  int write_offset;                 //下一个写入的位置
+  int write_offset;                 //叶节点文件中下一个写入的位置
+  int free_head;                    //空闲叶节点链表的表头，空闲节点用next串起来
+  int root_is_leaf;                 //根节点是否是叶节点
+  int inner_write_offset;           //内部节点文件中下一个写入的位置
+  int inner_free_head;              //空闲内部节点链表的表头
 
-  BPT_Meta() : root(0), total_num(0), write_offset(3 * sizeof(int)) {};
-  
-  BPT_Meta(int _root, int _total_num, int _write_offset) {
-    root = _root;
-    total_num = _total_num;
-    write_offset = _write_offset;
-  }
+  BPT_Meta() : root(-1), total_num(0), write_offset(0), free_head(-1),
+  root_is_leaf(1), inner_write_offset(0), inner_free_head(-1) {};
 };
 
 /********************************************************************/
-template<class T, int SIZE, int cache_size>
+//unique_key为true时每个key最多对应一个value，插入已有的key会被忽略
+//K是key的类型，key之间的比较由KeyCompare<K>决定
+//叶子和内部节点分别存放在base_filename和base_filename + "_inner"两个文件中
+//PAGE是每个节点所占的字节数，取2的幂，一般用操作系统页大小的整数倍(4096、16384、65536)
+//叶子和内部节点的扇出都由PAGE在编译期算出
+template<class T, int PAGE, int cache_size, bool unique_key = false, class K = Key,
+         template<class> class Policy = LRUPolicy>
 class BPlusTree {
 private:
+  using S = typename SortKey<T>::type;
+  using Sep = KeyValue<S, K>;
+
+public:
+  //一页能放下的键值对个数，扣掉节点头部和5个溢出槽
+  static constexpr int SIZE = (PAGE - 8 * (int)sizeof(int)) / (int)sizeof(KeyValue<T, K>) - 5;
+  //一页能放下的分隔键个数，每个分隔键还带一个子节点偏移量
+  static constexpr int INNER_SIZE = (PAGE - 16 * (int)sizeof(int) - 5 * (int)sizeof(Sep))
+                                    / ((int)sizeof(Sep) + (int)sizeof(int));
+  static_assert((PAGE & (PAGE - 1)) == 0, "PAGE must be a power of two");
+  static_assert(SIZE >= 3 && INNER_SIZE >= 3, "PAGE is too small for this value type");
+
+private:
+  using Leaf = LeafNode<T, SIZE, K>;
+  using Inner = InnerNode<S, INNER_SIZE, K>;
+  static_assert(sizeof(Leaf) <= PAGE && sizeof(Inner) <= PAGE, "node must fit in one page");
+
   string file_name;
-  MemoryRiver<IndexNode<T, SIZE>, 3> IndexFile;
+  WriteAheadLog* wal;               //接入的写前日志，没有时为nullptr
+  MemoryRiver<Leaf, 5> LeafFile;
+  MemoryRiver<Inner, 2> InnerFile;
   BPT_Meta basic_info;
 
-  /*cache结构体*/
-  struct CacheEntry {
-    IndexNode<T, SIZE> node;
-    bool dirty = false;
-    CacheEntry* prev = nullptr;
-    CacheEntry* next = nullptr;
-    CacheEntry(const IndexNode<T, SIZE>& n) : node(n) {}
-  };
+  //文件头独占第一页，之后每个节点占一页，节点的偏移量都在页边界上
+  static constexpr int node_begin = PAGE;
 
-  sjtu::map<int, CacheEntry*> cache;
-  CacheEntry* lru_head = nullptr;
-  CacheEntry* lru_tail = nullptr;
-  int access_counter = 0;
-
-  void moveToHead(CacheEntry* ce) {
-    if (ce == lru_head) return;
-    if (ce->prev) ce->prev->next = ce->next;
-    if (ce->next) ce->next->prev = ce->prev;
-    if (ce == lru_tail) lru_tail = ce->prev;
-    ce->prev = nullptr;
-    ce->next = lru_head;
-    if (lru_head) lru_head->prev = ce;
-    lru_head = ce;
-    if (!lru_tail) lru_tail = ce;
-  }
-
-  void addToHead(CacheEntry* ce) {
-    ce->prev = nullptr;
-    ce->next = lru_head;
-    if (lru_head) lru_head->prev = ce;
-    lru_head = ce;
-    if (!lru_tail) lru_tail = ce;
-  }
-
-  void evictLRU() {
-    if (!lru_tail) return;
-    CacheEntry* old = lru_tail;
-    if (old->dirty) {
-      IndexFile.writeT(old->node, old->node.offset);
-      old->dirty = false;
-    }
-    cache.erase(cache.find(old->node.offset));
-    if (old->prev) {
-      old->prev->next = old->next;
-    } else {
-      lru_head = old->next;
-    }
-    if (old->next) {
-      old->next->prev = old->prev;
-    } else {
-      lru_tail = old->prev;
-    }
-    delete old;
+  //节点缓存，句柄存活期间节点被pin住
+  using LeafHandle = typename BufferPool<Leaf, 5, cache_size, Policy>::Handle;
+  using InnerHandle = typename BufferPool<Inner, 2, cache_size, Policy>::Handle;
+  BufferPool<Leaf, 5, cache_size, Policy> leaf_cache;
+  BufferPool<Inner, 2, cache_size, Policy> inner_cache;
+  int read_ahead = 4;                //范围扫描越过叶子时最多往后预读的叶子数
+
+  /*多线程访问，见set_concurrent*/
+  bool concurrent = false;
+  RWLatch structure;                 //分裂、合并等改变树结构的操作独占，原地修改叶子的操作共享，读者乐观地读
+  std::mutex meta;                   //保护元素个数和叶子文件头的写入
+  ReaderSlots readers;               //正在乐观读的读者，清空树之前要等它们离开
+  std::atomic<unsigned> shrinks{0};  //合并、借位和清空的次数，这些操作会把元素往左移或者回收叶子
+
+  std::unique_lock<RWLatch> exclusiveGuard() {
+    return concurrent ? std::unique_lock<RWLatch>(structure) : std::unique_lock<RWLatch>();
+  }
+
+  /*****BPT_Meta的读取和写入*****/
+  //读入BPT_Meta
+  void readInfo() {
+    int info[5] = {-1, 0, node_begin, -1, 1};
+    LeafFile.get_all_info(info);
+    basic_info.root = info[0];
+    basic_info.total_num = info[1];
+    basic_info.write_offset = info[2];
+    basic_info.free_head = info[3];
+    basic_info.root_is_leaf = info[4];
+    int inner_info[2] = {node_begin, -1};
+    InnerFile.get_all_info(inner_info);
+    basic_info.inner_write_offset = inner_info[0];
+    basic_info.inner_free_head = inner_info[1];
+  }
+
+  //用basic_info更新信息
+  void updateInfo() {
+    int info[5] = {basic_info.root, basic_info.total_num, basic_info.write_offset,
+                   basic_info.free_head, basic_info.root_is_leaf};
+    LeafFile.write_all_info(info);
+  }
+
+  //内部节点文件的信息只在分配和释放内部节点时改变
+  void updateInnerInfo() {
+    int info[2] = {basic_info.inner_write_offset, basic_info.inner_free_head};
+    InnerFile.write_all_info(info);
+  }
+
+  /*****节点的分配和释放*****/
+  //新节点只初始化元信息，kv_num之后的内容没有意义
+  void resetLeaf(Leaf& node, int index) {
+    node.parent = -1;
+    node.prev = -1;
+    node.next = -1;
+    node.kv_num = 0;
+    node.offset = index;
+  }
+
+  void resetInner(Inner& node, int index) {
+    node.leaf_children = false;
+    node.parent = -1;
+    node.kv_num = 0;
+    for (int i = 0; i < INNER_SIZE + 6; ++i) {
+      node.child_offset[i] = -1;
+    }
+    node.offset = index;
   }
 
-  IndexNode<T, SIZE> cacheread(int index) {
-    auto it = cache.find(index);
-    if (it != cache.end()) {
-      CacheEntry* ce = it->second;
-      moveToHead(ce);
-      return ce->node;
+  //pin住index位置的节点，多线程访问时按mode给叶子加锁
+  //内部节点只在独占整棵树时才会改变，不用加锁
+  LeafHandle pinLeaf(int index, LatchMode mode = LatchMode::None) {
+    LeafHandle leaf = leaf_cache.pin(index);
+    if (concurrent) leaf.latch(mode);
+    return leaf;
+  }
+
+  InnerHandle pinInner(int index) {
+    return inner_cache.pin(index);
+  }
+
+  /*
+  从offset开始沿叶子链表预读最多read_ahead个叶子
+  已经在缓存或者内核缓冲中的叶子不用等磁盘就能读出next，继续往后找
+  遇到要读盘的叶子时提示内核异步读入，它后面的叶子要等扫描走到它时才知道在哪里
+  */
+  void readAhead(int offset) {
+    for (int i = 0; i < read_ahead && offset != -1; ++i) {
+      int next;
+      if (leaf_cache.peek(offset, [&next](const Leaf& leaf) { next = leaf.next; })) {
+        offset = next;
+        continue;
+      }
+      if (!LeafFile.read_cached(&next, sizeof(next), offset + offsetof(Leaf, next))) {
+        LeafFile.prefetch(offset);
+        return;
+      }
+      offset = next;
     }
-    IndexNode<T, SIZE> node;
-    IndexFile.read(node, index);
-    if ((int)cache.size() >= cache_size) evictLRU();
-    CacheEntry* ce = new CacheEntry(node);
-    cache[index] = ce;
-    addToHead(ce);
+  }
+
+  //扫描沿链表走到兄弟叶子，兄弟不在缓存中说明扫描开始读盘了，顺便预读后面的叶子
+  LeafHandle pinSibling(int index) {
+    bool miss = !leaf_cache.cached(index);
+    LeafHandle leaf = pinLeaf(index);
+    if (miss) readAhead(leaf->next);
+    return leaf;
+  }
+
+  //分配一个新节点，优先复用空闲链表中的节点，否则在write_offset处追加
+  //新节点直接放进cache并标记为dirty
+  LeafHandle newLeaf() {
+    if (basic_info.free_head != -1) {
+      LeafHandle node = pinLeaf(basic_info.free_head);
+      basic_info.free_head = node->next;
+      resetLeaf(*node, node->offset);
+      node.markDirty();
+      return node;
+    }
+    int index = basic_info.write_offset;
+    basic_info.write_offset += PAGE;
+    LeafHandle node = leaf_cache.create(index);
+    resetLeaf(*node, index);
     return node;
   }
 
-  void cachewrite(IndexNode<T, SIZE>& node) {
-    auto it = cache.find(node.offset);
-    if (it != cache.end()) {
-      CacheEntry* ce = it->second;
-      ce->node = node;
-      ce->dirty = true;
-      moveToHead(ce);
+  InnerHandle newInner() {
+    InnerHandle node;
+    if (basic_info.inner_free_head != -1) {
+      node = pinInner(basic_info.inner_free_head);
+      basic_info.inner_free_head = node->parent;
+      resetInner(*node, node->offset);
+      node.markDirty();
     } else {
-      IndexFile.writeT(node, node.offset);
+      int index = basic_info.inner_write_offset;
+      basic_info.inner_write_offset += PAGE;
+      node = inner_cache.create(index);
+      resetInner(*node, index);
     }
+    updateInnerInfo();
+    return node;
   }
 
-  /*****BPT_Meta的读取和写入*****/
-  //读入BOPT_Meta
-  BPT_Meta readInfo() {
-    int r = 0, t = 0, w = 0;
-    IndexFile.get_info(r, 1);
-    IndexFile.get_info(t, 2);
-    IndexFile.get_info(w, 3);
-    return BPT_Meta(r, t, w);
+  //被合并掉的节点放进空闲链表，之后分裂时复用
+  void freeLeaf(LeafHandle& node) {
+    node->kv_num = 0;
+    node->parent = -1;
+    node->prev = -1;
+    node->next = basic_info.free_head;
+    basic_info.free_head = node->offset;
+    node.markDirty();
   }
 
-  //用basic_info更新信息
-  void updateInfo() {
-    IndexFile.write_info(basic_info.root, 1);
-    IndexFile.write_info(basic_info.total_num, 2);
-    IndexFile.write_info(basic_info.write_offset, 3);
-  }
-
-  /*****IndexFile的读取和写入*****/
-  //在index位置读取一个Node
-  IndexNode<T, SIZE> readNode(int index) {
-    auto it = cache.find(index);
-    if (it != cache.end()) {
-      CacheEntry* ce = it->second;
-      moveToHead(ce);
-      return ce->node;
-    }
-    IndexNode<T, SIZE> node;
-    IndexFile.read(node, index);
-    if ((int)cache.size() >= cache_size) evictLRU();
-    CacheEntry* ce = new CacheEntry(node);
-    cache[index] = ce;
-    addToHead(ce);
-    return node;
+  void freeInner(InnerHandle& node) {
+    node->kv_num = 0;
+    node->parent = basic_info.inner_free_head;
+    basic_info.inner_free_head = node->offset;
+    node.markDirty();
+    updateInnerInfo();
   }
 
-  //在合适位置写入一个Node
-  void writeNode(IndexNode<T, SIZE>& node) {
-    auto it = cache.find(node.offset);
-    if (it != cache.end()) {
-      CacheEntry* ce = it->second;
-      ce->node = node;
-      ce->dirty = true;
-      moveToHead(ce);
+  //修改子节点的parent，leaf表示子节点是否是叶节点
+  void setParent(int child, bool leaf, int parent) {
+    if (leaf) {
+      LeafHandle node = pinLeaf(child);
+      node->parent = parent;
+      node.markDirty();
     } else {
-      IndexFile.writeT(node, node.offset);
+      InnerHandle node = pinInner(child);
+      node->parent = parent;
+      node.markDirty();
     }
   }
 
-  /*****split操作*****/
-  void splitLeaf(IndexNode<T, SIZE>& node) {
-    //std::cout << "SplitLeaf" << std::endl;
-    //for (int i = 0; i < node.kv_num; ++i) {
-    //  std::cout << node.keyvalues[i] << " ";
-    //}
-    //std::cout << std::endl;
-    IndexNode<T, SIZE> NewLeaf;
-    NewLeaf.offset = basic_info.write_offset;
-    basic_info.write_offset += sizeof(IndexNode<T, SIZE>);
-    NewLeaf.is_leaf = true;
-    NewLeaf.parent = node.parent;
-
-    int split_pos = node.kv_num / 2;
-    NewLeaf.kv_num = node.kv_num - split_pos;
-    for (int i = 0; i < NewLeaf.kv_num; ++i) {
-      NewLeaf.keyvalues[i] = node.keyvalues[i + split_pos];
-      NewLeaf.child_offset[i] = node.child_offset[i + split_pos];
-    }
-    node.kv_num = split_pos;
-    
-    //调整单向链表的关系
-    NewLeaf.next = node.next;
-    node.next = NewLeaf.offset;
-    NewLeaf.prev = node.offset;
-    if (NewLeaf.next != -1) {
-      IndexNode<T, SIZE> NewNext = readNode(NewLeaf.next);
-      NewNext.prev = NewLeaf.offset;
-      writeNode(NewNext);
-    }
-    writeNode(node);
-    writeNode(NewLeaf);
+  /*****分隔键*****/
+  static int compareKey(const K& a, const K& b) {
+    return KeyCompare<K>::compare(a, b);
+  }
 
-    //调整Key
-    KeyValue<T> NewKV = NewLeaf.keyvalues[0];
-    if (node.parent == -1) {
-      IndexNode<T, SIZE> NewRoot(false, -1, -1, -1, 1, 0);
-      NewRoot.offset = basic_info.write_offset;
-      basic_info.write_offset += sizeof(IndexNode<T, SIZE>);
-      NewRoot.keyvalues[0] = NewKV;
-      NewRoot.child_offset[0] = node.offset;
-      NewRoot.child_offset[1] = NewLeaf.offset;
-      node.parent = NewRoot.offset;
-      NewLeaf.parent = NewRoot.offset;
-      basic_info.root = NewRoot.offset;
-      writeNode(NewRoot);
-      writeNode(node);
-      writeNode(NewLeaf);
-    } else {
-      //std::cout << "modify parent" << std::endl;
-      IndexNode<T, SIZE> Parent = readNode(node.parent);
-      int pos = 0;
-      while (pos < Parent.kv_num && !(Parent.child_offset[pos] == node.offset)) {
-        ++pos;
-      }
-      //std::cout << "pos: " << pos << std::endl;
-      for (int i = Parent.kv_num; i > pos; --i) {
-        Parent.keyvalues[i] = Parent.keyvalues[i - 1];
-        Parent.child_offset[i + 1] = Parent.child_offset[i];
-      }
-      Parent.keyvalues[pos] = NewKV;
-      Parent.child_offset[pos + 1] = NewLeaf.offset;
-      //std::cout << "pos: " << pos << std::endl;
-      //std::cout << "Parent.child_offset[" << pos + 1 << "]: " << Parent.child_offset[pos + 1] << std::endl;
-      Parent.kv_num++;
-      writeNode(Parent);
-      if (Parent.kv_num > SIZE) {
-        splitNode(Parent);
-      }
-      //for (int i = 0; i < Parent.kv_num + 1; ++i) {
-      //  std::cout << Parent.child_offset[i] << " ";
-      //}
-      //std::cout << std::endl;
+  //叶子中的键值对对应的分隔键
+  static Sep toSep(const KeyValue<T, K>& kv) {
+    return Sep(kv.key, SortKey<T>::get(kv.value));
+  }
+
+  //比较键值对和分隔键，key相同时比较value的排序键
+  static int compareSep(const KeyValue<T, K>& kv, const Sep& sep) {
+    int res = compareKey(kv.key, sep.key);
+    if (res != 0) return res;
+    const S& sort_key = SortKey<T>::get(kv.value);
+    return sort_key < sep.value ? -1 : (sep.value < sort_key ? 1 : 0);
+  }
+
+  //两个键值对是否算作重复，唯一键模式下只比较key
+  static bool sameEntry(const KeyValue<T, K>& a, const KeyValue<T, K>& b) {
+    return unique_key ? compareKey(a.key, b.key) == 0 : a == b;
+  }
+
+  static bool sameSep(const KeyValue<T, K>& kv, const Sep& sep) {
+    return unique_key ? compareKey(kv.key, sep.key) == 0 : compareSep(kv, sep) == 0;
+  }
+
+  /*****split操作*****/
+  //right是从left分裂出来的节点，把分隔键sep插入到父节点parent中
+  //left是根时新建一个根，leaf表示left和right是否是叶节点
+  void insertIntoParent(int parent, int left, int right, bool leaf, const Sep& sep) {
+    if (parent == -1) {
+      InnerHandle NewRoot = newInner();
+      NewRoot->leaf_children = leaf;
+      NewRoot->kv_num = 1;
+      NewRoot->keys[0] = sep;
+      NewRoot->child_offset[0] = left;
+      NewRoot->child_offset[1] = right;
+      setParent(left, leaf, NewRoot->offset);
+      setParent(right, leaf, NewRoot->offset);
+      basic_info.root = NewRoot->offset;
+      basic_info.root_is_leaf = 0;
+      return;
+    }
+    InnerHandle Parent = pinInner(parent);
+    int pos = 0;
+    while (pos < Parent->kv_num && !(Parent->child_offset[pos] == left)) {
+      ++pos;
+    }
+    for (int i = Parent->kv_num; i > pos; --i) {
+      Parent->keys[i] = Parent->keys[i - 1];
+      Parent->child_offset[i + 1] = Parent->child_offset[i];
+    }
+    Parent->keys[pos] = sep;
+    Parent->child_offset[pos + 1] = right;
+    Parent->kv_num++;
+    Parent.markDirty();
+    if (Parent->kv_num > INNER_SIZE) {
+      splitInner(Parent);
     }
-    updateInfo();
   }
 
-  void splitInt(IndexNode<T, SIZE>& node) {
-    //std::cout << "SplitInt" << std::endl;
-    IndexNode<T, SIZE> NewInt;
-    NewInt.offset = basic_info.write_offset;
-    basic_info.write_offset += sizeof(IndexNode<T, SIZE>);
-    NewInt.is_leaf = false;
-    NewInt.parent = node.parent;
-
-    int SplitPos = node.kv_num / 2;
-    KeyValue<T> temp_kv = node.keyvalues[SplitPos];
-    NewInt.kv_num = node.kv_num - SplitPos - 1;
-    for (int i = 0; i < NewInt.kv_num; ++i) {
-      NewInt.keyvalues[i] = node.keyvalues[i + SplitPos + 1];
-    }
-    for (int i = 0; i <= NewInt.kv_num; ++i) {
-      NewInt.child_offset[i] = node.child_offset[i + SplitPos + 1];
-      IndexNode<T, SIZE> child = readNode(NewInt.child_offset[i]);
-      child.parent = NewInt.offset;
-      writeNode(child);
-    }
-
-    node.kv_num = SplitPos;
-    KeyValue NewKV = NewInt.keyvalues[0];
-
-    if (node.parent == -1) {
-      IndexNode<T, SIZE> NewRoot;
-      NewRoot.offset = basic_info.write_offset;
-      basic_info.write_offset += sizeof(IndexNode<T, SIZE>);
-      NewRoot.is_leaf = false;
-      NewRoot.kv_num = 1;
-      NewRoot.keyvalues[0] = temp_kv;
-      NewRoot.child_offset[0] = node.offset;
-      NewRoot.child_offset[1] = NewInt.offset;
-      node.parent = NewRoot.offset;
-      NewInt.parent = NewRoot.offset;
-      basic_info.root = NewRoot.offset;
-      writeNode(node);
-      writeNode(NewInt);
-      writeNode(NewRoot);
-    } else {
-      IndexNode<T, SIZE> Parent = readNode(node.parent);
-      int pos = 0;
-      while (pos < Parent.kv_num && !(Parent.child_offset[pos] == node.offset)) {
-        //for (int i = 0; i < temp.kv_num; ++i) {
-        //  std::cout << temp.keyvalues[i] << " ";
-        //} 
-        ++pos;
-      }
-      for (int i = Parent.kv_num; i > pos; --i) {
-        Parent.keyvalues[i] = Parent.keyvalues[i - 1];
-        Parent.child_offset[i + 1] = Parent.child_offset[i];
-      }
-      Parent.keyvalues[pos] = temp_kv;
-      Parent.child_offset[pos + 1] = NewInt.offset;
-      Parent.kv_num++;
-      writeNode(Parent);
-      writeNode(node);
-      writeNode(NewInt);
-      if (Parent.kv_num > SIZE) {
-        splitNode(Parent);
-      }
+  void splitLeaf(LeafHandle& node) {
+    LeafHandle NewLeaf = newLeaf();
+    NewLeaf->parent = node->parent;
+
+    int split_pos = node->kv_num / 2;
+    NewLeaf->kv_num = node->kv_num - split_pos;
+    for (int i = 0; i < NewLeaf->kv_num; ++i) {
+      NewLeaf->keyvalues[i] = node->keyvalues[i + split_pos];
     }
+    node->kv_num = split_pos;
+
+    //调整双向链表的关系
+    NewLeaf->next = node->next;
+    node->next = NewLeaf->offset;
+    NewLeaf->prev = node->offset;
+    if (NewLeaf->next != -1) {
+      LeafHandle NewNext = pinLeaf(NewLeaf->next);
+      NewNext->prev = NewLeaf->offset;
+      NewNext.markDirty();
+    }
+    node.markDirty();
+
+    //调整Key
+    insertIntoParent(node->parent, node->offset, NewLeaf->offset, true, toSep(NewLeaf->keyvalues[0]));
     updateInfo();
   }
 
-  void splitNode(IndexNode<T, SIZE>& node) {
-    if (node.is_leaf) splitLeaf(node);
-    else splitInt(node);
+  void splitInner(InnerHandle& node) {
+    InnerHandle NewInt = newInner();
+    NewInt->leaf_children = node->leaf_children;
+    NewInt->parent = node->parent;
+
+    int SplitPos = node->kv_num / 2;
+    Sep temp_key = node->keys[SplitPos];
+    NewInt->kv_num = node->kv_num - SplitPos - 1;
+    for (int i = 0; i < NewInt->kv_num; ++i) {
+      NewInt->keys[i] = node->keys[i + SplitPos + 1];
+    }
+    for (int i = 0; i <= NewInt->kv_num; ++i) {
+      NewInt->child_offset[i] = node->child_offset[i + SplitPos + 1];
+      setParent(NewInt->child_offset[i], node->leaf_children, NewInt->offset);
+    }
+
+    node->kv_num = SplitPos;
+    node.markDirty();
+
+    insertIntoParent(node->parent, node->offset, NewInt->offset, false, temp_key);
+    updateInfo();
   }
 
   /*****merge操作*****/
-  void mergeLeaf(IndexNode<T, SIZE>& node) {
-    if (node.parent == -1) return;
-    //cout << "parent node offsert = " << node.parent << endl;
-    IndexNode<T, SIZE> parent_node = readNode(node.parent);
+  void mergeLeaf(LeafHandle& node) {
+    if (node->parent == -1) return;
+    ++shrinks;
+    InnerHandle parent_node = pinInner(node->parent);
     int index = -1;
-    for (int i = 0; i <= parent_node.kv_num; ++i) {
-      if (parent_node.child_offset[i] == node.offset) {
+    for (int i = 0; i <= parent_node->kv_num; ++i) {
+      if (parent_node->child_offset[i] == node->offset) {
         index = i;
         break;
       }
     }
-    //std::cout << "index: " << index << std::endl;
     if (index == -1) return;
     if (index > 0) {
-      //std::cout << "borrow from left" << std::endl;
-      IndexNode<T, SIZE> left_sibling = readNode(parent_node.child_offset[index - 1]);
-      if (left_sibling.kv_num > (SIZE + 1) / 2) {
+      LeafHandle left_sibling = pinLeaf(parent_node->child_offset[index - 1]);
+      if (left_sibling->kv_num > (SIZE + 1) / 2) {
         // 借位
-        for (int i = node.kv_num; i > 0; --i) {
-          node.keyvalues[i] = node.keyvalues[i - 1];
-          node.child_offset[i] = node.child_offset[i - 1];
+        for (int i = node->kv_num; i > 0; --i) {
+          node->keyvalues[i] = node->keyvalues[i - 1];
         }
-        node.keyvalues[0] = left_sibling.keyvalues[left_sibling.kv_num - 1];
-        node.child_offset[0] = left_sibling.child_offset[left_sibling.kv_num - 1];
-        node.kv_num++;
-        left_sibling.kv_num--;
-        parent_node.keyvalues[index - 1] = node.keyvalues[0];
-        writeNode(left_sibling);
-        writeNode(node);
-        writeNode(parent_node);
+        node->keyvalues[0] = left_sibling->keyvalues[left_sibling->kv_num - 1];
+        node->kv_num++;
+        left_sibling->kv_num--;
+        parent_node->keys[index - 1] = toSep(node->keyvalues[0]);
+        left_sibling.markDirty();
+        node.markDirty();
+        parent_node.markDirty();
         return;
       }
     }
-    if (index < parent_node.kv_num) {
-      //std::cout << "borrow from right" << std::endl;
-      IndexNode<T, SIZE> right_sibling = readNode(parent_node.child_offset[index + 1]);
-      if (right_sibling.kv_num > (SIZE + 1) / 2) {
+    if (index < parent_node->kv_num) {
+      LeafHandle right_sibling = pinLeaf(parent_node->child_offset[index + 1]);
+      if (right_sibling->kv_num > (SIZE + 1) / 2) {
         // 借位
-        node.keyvalues[node.kv_num] = right_sibling.keyvalues[0];
-        node.child_offset[node.kv_num] = right_sibling.child_offset[0];
-        node.kv_num++;
-        for (int i = 0; i < right_sibling.kv_num - 1; ++i) {
-          right_sibling.keyvalues[i] = right_sibling.keyvalues[i + 1];
-          right_sibling.child_offset[i] = right_sibling.child_offset[i + 1];
+        node->keyvalues[node->kv_num] = right_sibling->keyvalues[0];
+        node->kv_num++;
+        for (int i = 0; i < right_sibling->kv_num - 1; ++i) {
+          right_sibling->keyvalues[i] = right_sibling->keyvalues[i + 1];
         }
-        right_sibling.kv_num--;
-        parent_node.keyvalues[index] = right_sibling.keyvalues[0];
-        writeNode(right_sibling);
-        writeNode(node);
-        writeNode(parent_node);
+        right_sibling->kv_num--;
+        parent_node->keys[index] = toSep(right_sibling->keyvalues[0]);
+        right_sibling.markDirty();
+        node.markDirty();
+        parent_node.markDirty();
         return;
       }
     }
-    //std::cout << "index: " << index << std::endl;
     if (index > 0) {
-      //std::cout << "merge left" << std::endl;
-      IndexNode<T, SIZE> left_sibling = readNode(parent_node.child_offset[index - 1]);
-      int start = left_sibling.kv_num;
-      for (int i = 0; i < node.kv_num; ++i) {
-        left_sibling.keyvalues[start + i] = node.keyvalues[i];
-        left_sibling.child_offset[start + i] = node.child_offset[i];
+      LeafHandle left_sibling = pinLeaf(parent_node->child_offset[index - 1]);
+      int start = left_sibling->kv_num;
+      for (int i = 0; i < node->kv_num; ++i) {
+        left_sibling->keyvalues[start + i] = node->keyvalues[i];
       }
-      left_sibling.kv_num += node.kv_num;
-      left_sibling.next = node.next;
-      if (node.next != -1) {
-        IndexNode<T, SIZE> nextleaf = readNode(node.next);
-        nextleaf.prev = left_sibling.offset;
-        writeNode(nextleaf);
+      left_sibling->kv_num += node->kv_num;
+      left_sibling->next = node->next;
+      if (node->next != -1) {
+        LeafHandle nextleaf = pinLeaf(node->next);
+        nextleaf->prev = left_sibling->offset;
+        nextleaf.markDirty();
       }
-      for (int i = index; i < parent_node.kv_num; ++i) {
-        parent_node.keyvalues[i - 1] = parent_node.keyvalues[i];
-        parent_node.child_offset[i] = parent_node.child_offset[i + 1];
+      for (int i = index; i < parent_node->kv_num; ++i) {
+        parent_node->keys[i - 1] = parent_node->keys[i];
+        parent_node->child_offset[i] = parent_node->child_offset[i + 1];
       }
-      parent_node.kv_num--;
-      writeNode(left_sibling);
-      writeNode(parent_node);
-      node.kv_num = 0;
-      node.offset = -1;
-      node.parent = -1;
-      node.prev = -1;
-      node.next = -1;
-      for (int i = 0; i < SIZE + 5; ++i) {
-        node.keyvalues[i] = KeyValue<T>();
-        node.child_offset[i] = -1;
+      parent_node->kv_num--;
+      left_sibling.markDirty();
+      parent_node.markDirty();
+      freeLeaf(node);
+      if (parent_node->kv_num < (INNER_SIZE + 1) / 2) {
+        mergeInner(parent_node);
       }
-      writeNode(node);
-      if (parent_node.kv_num < (SIZE + 1) / 2) {
-        mergeNode(parent_node);
+    } else if (index <= parent_node->kv_num) {
+      if (parent_node->child_offset[index + 1] == -1) return;
+      LeafHandle right_sibling = pinLeaf(parent_node->child_offset[index + 1]);
+      int start = node->kv_num;
+      for (int i = 0; i < right_sibling->kv_num; ++i) {
+        node->keyvalues[start + i] = right_sibling->keyvalues[i];
       }
-    } else if (index <= parent_node.kv_num) {
-      //std::cout << "merge right" << std::endl;
-      IndexNode<T, SIZE> right_sibling = readNode(parent_node.child_offset[index + 1]);
-      int start = node.kv_num;
-      for (int i = 0; i < right_sibling.kv_num; ++i) {
-        node.keyvalues[start + i] = right_sibling.keyvalues[i];
-        node.child_offset[start + i] = right_sibling.child_offset[i];
+      node->kv_num += right_sibling->kv_num;
+      node->next = right_sibling->next;
+      if (right_sibling->next != -1) {
+        LeafHandle nextleaf = pinLeaf(right_sibling->next);
+        nextleaf->prev = node->offset;
+        nextleaf.markDirty();
       }
-      node.kv_num += right_sibling.kv_num;
-      node.next = right_sibling.next;
-      if (right_sibling.next != -1) {
-        IndexNode<T, SIZE> nextleaf = readNode(right_sibling.next);
-        nextleaf.prev = node.offset;
-        writeNode(nextleaf);
+      for (int i = index + 1; i < parent_node->kv_num; ++i) {
+        parent_node->keys[i - 1] = parent_node->keys[i];
+        parent_node->child_offset[i] = parent_node->child_offset[i + 1];
       }
-      for (int i = index + 1; i < parent_node.kv_num; ++i) {
-        parent_node.keyvalues[i - 1] = parent_node.keyvalues[i];
-        parent_node.child_offset[i] = parent_node.child_offset[i + 1];
-      }
-      parent_node.kv_num--;
-      writeNode(node);
-      writeNode(parent_node);
-      right_sibling.kv_num = 0;
-      right_sibling.offset = -1;
-      right_sibling.parent = -1;
-      right_sibling.prev = -1;
-      right_sibling.next = -1;
-      for (int i = 0; i < SIZE + 5; ++i) {
-          right_sibling.keyvalues[i] = KeyValue<T>();
-          right_sibling.child_offset[i] = -1;
-      }
-      writeNode(right_sibling);
-      if (parent_node.kv_num < (SIZE + 1) / 2) {
-        mergeNode(parent_node);
+      parent_node->kv_num--;
+      node.markDirty();
+      parent_node.markDirty();
+      freeLeaf(right_sibling);
+      if (parent_node->kv_num < (INNER_SIZE + 1) / 2) {
+        mergeInner(parent_node);
       }
     }
   }
 
-  void mergeInt(IndexNode<T, SIZE>& node) {
-    if (node.parent == -1) {
-      if (node.kv_num == 0 && node.child_offset[0] != -1) {
-        basic_info.root = node.child_offset[0];
-        IndexNode<T, SIZE> child = readNode(node.child_offset[0]);
-        child.parent = -1;
-        writeNode(child);
+  void mergeInner(InnerHandle& node) {
+    bool leaf = node->leaf_children;
+    if (node->parent == -1) {
+      if (node->kv_num == 0 && node->child_offset[0] != -1) {
+        basic_info.root = node->child_offset[0];
+        basic_info.root_is_leaf = leaf;
+        setParent(node->child_offset[0], leaf, -1);
+        freeInner(node);
       }
       return;
     }
-    IndexNode<T, SIZE> parent_node = readNode(node.parent);
+    InnerHandle parent_node = pinInner(node->parent);
     int index = -1;
-    for (int i = 0; i <= parent_node.kv_num; ++i) {
-      if (parent_node.child_offset[i] == node.offset) {
+    for (int i = 0; i <= parent_node->kv_num; ++i) {
+      if (parent_node->child_offset[i] == node->offset) {
         index = i;
         break;
       }
     }
     if (index == -1) return;
     if (index > 0) {
-      IndexNode<T, SIZE> left_sibling = readNode(parent_node.child_offset[index - 1]);
-      if (left_sibling.kv_num > (SIZE + 1) / 2) {
-        for (int i = node.kv_num; i > 0; --i) {
-          node.keyvalues[i] = node.keyvalues[i - 1];
-          node.child_offset[i + 1] = node.child_offset[i];
+      InnerHandle left_sibling = pinInner(parent_node->child_offset[index - 1]);
+      if (left_sibling->kv_num > (INNER_SIZE + 1) / 2) {
+        for (int i = node->kv_num; i > 0; --i) {
+          node->keys[i] = node->keys[i - 1];
+          node->child_offset[i + 1] = node->child_offset[i];
         }
-        node.child_offset[1] = node.child_offset[0];
-        node.keyvalues[0] = parent_node.keyvalues[index - 1];
-        node.child_offset[0] = left_sibling.child_offset[left_sibling.kv_num];
-        parent_node.keyvalues[index - 1] = left_sibling.keyvalues[left_sibling.kv_num - 1];
-        node.kv_num++;
-        left_sibling.kv_num--;
-        IndexNode<T, SIZE> child = readNode(node.child_offset[0]);
-        child.parent = node.offset;
-        writeNode(child);
-        writeNode(left_sibling);
-        writeNode(node);
-        writeNode(parent_node);
+        node->child_offset[1] = node->child_offset[0];
+        node->keys[0] = parent_node->keys[index - 1];
+        node->child_offset[0] = left_sibling->child_offset[left_sibling->kv_num];
+        parent_node->keys[index - 1] = left_sibling->keys[left_sibling->kv_num - 1];
+        node->kv_num++;
+        left_sibling->kv_num--;
+        setParent(node->child_offset[0], leaf, node->offset);
+        left_sibling.markDirty();
+        node.markDirty();
+        parent_node.markDirty();
         return;
       }
     }
-    if (index <= parent_node.kv_num) {
-      IndexNode<T, SIZE> right_sibling = readNode(parent_node.child_offset[index + 1]);
-      if (right_sibling.kv_num > (SIZE + 1) / 2) {
-        node.keyvalues[node.kv_num] = parent_node.keyvalues[index];
-        node.child_offset[node.kv_num + 1] = right_sibling.child_offset[0];
-        parent_node.keyvalues[index] = right_sibling.keyvalues[0];
-        node.kv_num++;
-        for (int i = 0; i < right_sibling.kv_num - 1; ++i) {
-          right_sibling.keyvalues[i] = right_sibling.keyvalues[i + 1];
-          right_sibling.child_offset[i] = right_sibling.child_offset[i + 1];
+    if (index < parent_node->kv_num) {
+      InnerHandle right_sibling = pinInner(parent_node->child_offset[index + 1]);
+      if (right_sibling->kv_num > (INNER_SIZE + 1) / 2) {
+        node->keys[node->kv_num] = parent_node->keys[index];
+        node->child_offset[node->kv_num + 1] = right_sibling->child_offset[0];
+        parent_node->keys[index] = right_sibling->keys[0];
+        node->kv_num++;
+        for (int i = 0; i < right_sibling->kv_num - 1; ++i) {
+          right_sibling->keys[i] = right_sibling->keys[i + 1];
+          right_sibling->child_offset[i] = right_sibling->child_offset[i + 1];
         }
-        right_sibling.child_offset[right_sibling.kv_num - 1] = right_sibling.child_offset[right_sibling.kv_num];
-        right_sibling.kv_num--;
-        IndexNode<T, SIZE> child = readNode(node.child_offset[node.kv_num]);
-        child.parent = node.offset;
-        writeNode(child);
-        writeNode(right_sibling);
-        writeNode(node);
-        writeNode(parent_node);
+        right_sibling->child_offset[right_sibling->kv_num - 1] = right_sibling->child_offset[right_sibling->kv_num];
+        right_sibling->kv_num--;
+        setParent(node->child_offset[node->kv_num], leaf, node->offset);
+        right_sibling.markDirty();
+        node.markDirty();
+        parent_node.markDirty();
         return;
       }
     }
     if (index > 0) {
-      IndexNode<T, SIZE> left_sibling = readNode(parent_node.child_offset[index - 1]);
-      int start = left_sibling.kv_num;
-      left_sibling.keyvalues[start] = parent_node.keyvalues[index - 1];
-      left_sibling.kv_num++;
-      for (int i = 0; i < node.kv_num; ++i) {
-        left_sibling.keyvalues[left_sibling.kv_num + i] = node.keyvalues[i];
-      }
-      for (int i = 0; i <= node.kv_num; ++i) {
-        left_sibling.child_offset[left_sibling.kv_num + i] = node.child_offset[i];
-        IndexNode<T, SIZE> child = readNode(node.child_offset[i]);
-        child.parent = left_sibling.offset;
-        writeNode(child);
-      }
-      left_sibling.kv_num += node.kv_num;
-      for (int i = index; i < parent_node.kv_num; ++i) {
-        parent_node.keyvalues[i - 1] = parent_node.keyvalues[i];
-        parent_node.child_offset[i] = parent_node.child_offset[i + 1];
+      InnerHandle left_sibling = pinInner(parent_node->child_offset[index - 1]);
+      int start = left_sibling->kv_num;
+      left_sibling->keys[start] = parent_node->keys[index - 1];
+      left_sibling->kv_num++;
+      for (int i = 0; i < node->kv_num; ++i) {
+        left_sibling->keys[left_sibling->kv_num + i] = node->keys[i];
       }
-      parent_node.kv_num--;
-      writeNode(left_sibling);
-      writeNode(parent_node);
-      node.kv_num = 0;
-      node.offset = -1;
-      node.parent = -1;
-      node.prev = -1;
-      node.next = -1;
-      for (int i = 0; i < SIZE + 5; ++i) {
-          node.keyvalues[i] = KeyValue<T>();
-          node.child_offset[i] = -1;
+      for (int i = 0; i <= node->kv_num; ++i) {
+        left_sibling->child_offset[left_sibling->kv_num + i] = node->child_offset[i];
+        setParent(node->child_offset[i], leaf, left_sibling->offset);
       }
-      writeNode(node);
-      if (parent_node.kv_num < (SIZE + 1) / 2) {
-        mergeNode(parent_node);
+      left_sibling->kv_num += node->kv_num;
+      for (int i = index; i < parent_node->kv_num; ++i) {
+        parent_node->keys[i - 1] = parent_node->keys[i];
+        parent_node->child_offset[i] = parent_node->child_offset[i + 1];
       }
-    } else if (index <= parent_node.kv_num) {
-      IndexNode<T, SIZE> right_sibling = readNode(parent_node.child_offset[index + 1]);
-      int start = node.kv_num;
-      node.keyvalues[start] = parent_node.keyvalues[index];
-      node.kv_num++;
-      for (int i = 0; i < right_sibling.kv_num; ++i) {
-        node.keyvalues[node.kv_num + i] = right_sibling.keyvalues[i];
+      parent_node->kv_num--;
+      left_sibling.markDirty();
+      parent_node.markDirty();
+      freeInner(node);
+      if (parent_node->kv_num < (INNER_SIZE + 1) / 2) {
+        mergeInner(parent_node);
       }
-      for (int i = 0; i <= right_sibling.kv_num; ++i) {
-        node.child_offset[node.kv_num + i] = right_sibling.child_offset[i];
-        IndexNode<T, SIZE> child = readNode(right_sibling.child_offset[i]);
-        child.parent = node.offset;
-        writeNode(child);
+    } else if (index <= parent_node->kv_num) {
+      if (parent_node->child_offset[index + 1] == -1) return;
+      InnerHandle right_sibling = pinInner(parent_node->child_offset[index + 1]);
+      int start = node->kv_num;
+      node->keys[start] = parent_node->keys[index];
+      node->kv_num++;
+      for (int i = 0; i < right_sibling->kv_num; ++i) {
+        node->keys[node->kv_num + i] = right_sibling->keys[i];
       }
-      node.kv_num += right_sibling.kv_num;
-      for (int i = index + 1; i < parent_node.kv_num; ++i) {
-        parent_node.keyvalues[i - 1] = parent_node.keyvalues[i];
-        parent_node.child_offset[i] = parent_node.child_offset[i + 1];
+      for (int i = 0; i <= right_sibling->kv_num; ++i) {
+        node->child_offset[node->kv_num + i] = right_sibling->child_offset[i];
+        setParent(right_sibling->child_offset[i], leaf, node->offset);
       }
-      parent_node.kv_num--;
-      writeNode(node);
-      writeNode(parent_node);
-      right_sibling.kv_num = 0;
-      right_sibling.offset = -1;
-      right_sibling.parent = -1;
-      right_sibling.prev = -1;
-      right_sibling.next = -1;
-      for (int i = 0; i < SIZE + 5; ++i) {
-          right_sibling.keyvalues[i] = KeyValue<T>();
-          right_sibling.child_offset[i] = -1;
+      node->kv_num += right_sibling->kv_num;
+      for (int i = index + 1; i < parent_node->kv_num; ++i) {
+        parent_node->keys[i - 1] = parent_node->keys[i];
+        parent_node->child_offset[i] = parent_node->child_offset[i + 1];
       }
-      writeNode(right_sibling);
-      if (parent_node.kv_num < (SIZE + 1) / 2) {
-        mergeNode(parent_node);
+      parent_node->kv_num--;
+      node.markDirty();
+      parent_node.markDirty();
+      freeInner(right_sibling);
+      if (parent_node->kv_num < (INNER_SIZE + 1) / 2) {
+        mergeInner(parent_node);
       }
     }
     updateInfo();
   }
 
-  void mergeNode(IndexNode<T, SIZE>& node) {
-    //std::cout << "merge" << std::endl;
-    if (node.is_leaf) mergeLeaf(node);
-    else mergeInt(node);
+  /*****查找*****/
+  /*
+  节点内的二分查找：before(i)在前一段位置上为真、后一段为假，返回第一个为假的位置
+  每轮只根据比较结果决定下标加多少，编译成条件传送而不是分支，比较结果难以预测时不会频繁冲刷流水线
+  */
+  template<class Before>
+  static int searchNode(int n, Before before) {
+    int base = 0;
+    while (n > 0) {
+      int half = n / 2;
+      base += before(base + half) ? n - half : 0;
+      n = half;
+    }
+    return base;
   }
 
-public:
-  BPlusTree(string base_filename) :
-  file_name(base_filename), IndexFile(base_filename), access_counter(0) {
-    fstream file(IndexFile.file_name, ios::in | ios::out | ios::binary);
-    if (!file.is_open()) {
-      IndexFile.initialise();
-      basic_info.root = -1;
-      basic_info.total_num = 0;
-      basic_info.write_offset = 3 * sizeof(int);
-      updateInfo();
-    } else {
-      basic_info = readInfo();
+  //从根下降到kv所在的叶子，inclusive为true时与分隔键相等走右子树
+  //upper不为空时存入叶子右侧最近的分隔键，bounded表示这样的分隔键是否存在
+  LeafHandle descend(const KeyValue<T, K>& kv, bool inclusive, Sep* upper = nullptr, bool* bounded = nullptr,
+                     LatchMode mode = LatchMode::None) {
+    if (bounded) *bounded = false;
+    int offset = basic_info.root;
+    bool leaf = basic_info.root_is_leaf;
+    while (!leaf) {
+      InnerHandle cur = pinInner(offset);
+      int left = searchNode(cur->kv_num, [&](int i) {
+        int res = compareSep(kv, cur->keys[i]);
+        return inclusive ? res >= 0 : res > 0;
+      });
+      if (upper && left < cur->kv_num) {
+        *upper = cur->keys[left];
+        *bounded = true;
+      }
+      offset = cur->child_offset[left];
+      leaf = cur->leaf_children;
     }
-  };
+    return pinLeaf(offset, mode);
+  }
 
-  ~BPlusTree() {
-    CacheEntry* cur = lru_head;
-    while (cur) {
-      if (cur->dirty) {
-        IndexFile.writeT(cur->node, cur->node.offset);
-        cur->dirty = false;
+  //最左边的叶子
+  LeafHandle firstLeaf() {
+    int offset = basic_info.root;
+    bool leaf = basic_info.root_is_leaf;
+    while (!leaf) {
+      InnerHandle cur = pinInner(offset);
+      offset = cur->child_offset[0];
+      leaf = cur->leaf_children;
+    }
+    return pinLeaf(offset);
+  }
+
+  //叶子中第一个不小于kv的位置
+  static int lowerBound(const Leaf& node, const KeyValue<T, K>& kv) {
+    return searchNode(node.kv_num, [&](int i) { return node.keyvalues[i] < kv; });
+  }
+
+  //找到kv所在的叶子并把它在叶子中的位置存入pos，找不到时返回无效的句柄
+  //下降时与分隔键相等走右子树，所以还要检查前一个叶子的末尾
+  LeafHandle locate(const KeyValue<T, K>& kv, int& pos) {
+    if (basic_info.root == -1) return LeafHandle();
+    LeafHandle cur = descend(kv, true);
+    pos = lowerBound(*cur, kv);
+    if (pos < cur->kv_num && cur->keyvalues[pos] == kv) return cur;
+    if (cur->prev == -1) return LeafHandle();
+    cur = pinLeaf(cur->prev);
+    if (cur->kv_num > 0 && cur->keyvalues[cur->kv_num - 1] == kv) {
+      pos = cur->kv_num - 1;
+      return cur;
+    }
+    return LeafHandle();
+  }
+
+  /*
+  乐观读(多线程访问时的查找和游标)：不加锁，读完节点后检查版本号，被修改过就重读
+  内部节点只在独占结构锁时改变，看结构锁的版本号；叶子还会被原地修改，再看叶子所在页的版本号
+  读到的叶子整个拷贝出来，游标之后只读拷贝；读的过程中登记为读者，保证pin住的页不会被清空树的操作丢弃
+
+  分裂只把元素移到右边新的兄弟中，游标拷贝叶子之后叶子分裂了，沿next往右走仍然不会漏掉元素，
+  往左走时看到左边叶子的next不是自己，就沿next往右走回自己左边的邻居，都不用从根重新下降；
+  合并和借位会把元素往左移、回收叶子，游标记下定位时shrinks的值，变了才重新定位
+  */
+  //拷贝叶子，kv_num是没有检查过的值，先限制在数组范围内
+  static void copyLeaf(const Leaf& src, Leaf& dst) {
+    int n = src.kv_num;
+    n = n < 0 ? 0 : (n > SIZE + 5 ? SIZE + 5 : n);
+    dst.parent = src.parent;
+    dst.prev = src.prev;
+    dst.next = src.next;
+    dst.kv_num = n;
+    dst.offset = src.offset;
+    std::memcpy(static_cast<void*>(dst.keyvalues), src.keyvalues, n * sizeof(KeyValue<T, K>));
+  }
+
+  //登记期间的一次下降：before(sep)为真时往右子树走，把到达的叶子拷贝到dst
+  //返回1表示成功，0表示树是空的，-1表示读的过程中树被修改了
+  template<class Before>
+  int readPath(Before before, Leaf& dst, unsigned version) {
+    int offset = basic_info.root;
+    bool leaf = basic_info.root_is_leaf;
+    if (!structure.validate(version)) return -1;
+    if (offset == -1) return 0;
+    while (!leaf) {
+      InnerHandle cur = pinInner(offset);
+      int n = cur->kv_num;
+      n = n < 0 ? 0 : (n > INNER_SIZE + 4 ? INNER_SIZE + 4 : n);
+      int left = searchNode(n, [&](int i) { return before(cur->keys[i]); });
+      offset = cur->child_offset[left];
+      leaf = cur->leaf_children;
+      if (!structure.validate(version)) return -1;
+    }
+    LeafHandle cur = pinLeaf(offset);
+    unsigned leaf_version = cur.optimistic();
+    copyLeaf(*cur, dst);
+    return cur.validate(leaf_version) && structure.validate(version) ? 1 : -1;
+  }
+
+  //乐观地下降到叶子并拷贝到dst，epoch存入此时shrinks的值，树是空的时返回false
+  template<class Before>
+  bool descendSnapshot(Before before, Leaf& dst, unsigned& epoch) {
+    for (;;) {
+      unsigned version = readers.enter(structure);
+      epoch = shrinks.load();
+      int res = readPath(before, dst, version);
+      readers.leave();
+      if (res != -1) return res == 1;
+    }
+  }
+
+  //乐观地把index处的叶子拷贝到dst，树在拷贝之前收缩过(shrinks不是epoch)时叶子可能已经被回收，返回false
+  bool snapshotLeaf(int index, Leaf& dst, unsigned epoch) {
+    for (;;) {
+      unsigned version = readers.enter(structure);
+      int res = 0;
+      if (shrinks.load() == epoch) {
+        LeafHandle cur = pinLeaf(index);
+        unsigned leaf_version = cur.optimistic();
+        copyLeaf(*cur, dst);
+        res = cur.validate(leaf_version) && structure.validate(version) ? 1 : -1;
       }
-      cur = cur->next;
+      readers.leave();
+      if (res != -1) return res == 1;
     }
-    cur = lru_head;
-    while (cur) {
-        CacheEntry* next = cur->next;
-        delete cur;
-        cur = next;
+  }
+
+  //拷贝snap右边的叶子，同pinSibling，要读盘时顺便预读后面的叶子
+  bool snapshotNext(Leaf& snap, unsigned epoch) {
+    int index = snap.next;
+    bool miss = !leaf_cache.cached(index);
+    if (!snapshotLeaf(index, snap, epoch)) return false;
+    if (miss) readAhead(snap.next);
+    return true;
+  }
+
+  //拷贝snap左边的叶子，左边的叶子在拷贝snap之后分裂过时沿next往右走，直到next是snap为止
+  bool snapshotPrev(Leaf& snap, unsigned epoch) {
+    int self = snap.offset;
+    if (!snapshotLeaf(snap.prev, snap, epoch)) return false;
+    while (snap.next != self) {
+      if (snap.next == -1 || !snapshotLeaf(snap.next, snap, epoch)) return false;
     }
-    lru_head = lru_tail = nullptr;
-  };
+    return true;
+  }
 
-  //向BPT中插入key_value键值对
-  void insert(const Key& key, T& value) {
-    if (find_pair(key, value)) return;
-    KeyValue<T> kv(key, value);
-    if (basic_info.total_num == 0) {
-      IndexNode<T, SIZE> root;
-      root.is_leaf = true;
-      root.kv_num = 1;
-      root.keyvalues[0] = kv;
-      root.offset = basic_info.write_offset;
-      basic_info.write_offset += sizeof(IndexNode<T, SIZE>);
-      basic_info.root = root.offset;
-      basic_info.total_num = 1;
-      writeNode(root);
-      updateInfo();
-    } else {
-      auto cur = readNode(basic_info.root);
-      while (!cur.is_leaf) {
-        int left = 0, right = cur.kv_num;
-        while (left < right) {
-          int mid = left + (right - left) / 2;
-          if (kv > cur.keyvalues[mid]) {
-            left = mid + 1;
-          } else {
-            right = mid;
-          }
-        }
-        int i = left;
-        cur = readNode(cur.child_offset[i]);
-      }
-      while (cur.keyvalues[cur.kv_num - 1] == kv && cur.next != -1 && cur.kv_num >= SIZE) {
-        auto temp_node = readNode(cur.next);
-        if (temp_node.kv_num > 0 && temp_node.keyvalues[0] == kv) {
-          cur = temp_node;
-        } else {
-          break;
+  //kv将要插入到leaf的pos处，检查它在全局顺序中的前后两个元素是否与它重复
+  //upper是下降时得到的右侧分隔键，右边叶子中的元素都不小于它，只有与它重复时才需要去看右边的叶子
+  //非唯一键模式下前面的元素都小于kv，唯一键模式下前一个元素可能有相同的key
+  bool duplicateAt(const LeafHandle& leaf, int pos, const KeyValue<T, K>& kv, const Sep& upper, bool bounded) {
+    if (pos < leaf->kv_num) {
+      if (sameEntry(leaf->keyvalues[pos], kv)) return true;
+    } else if (bounded && sameSep(kv, upper)) {
+      LeafHandle next = pinLeaf(leaf->next);
+      while (next->kv_num == 0 && next->next != -1) next = pinLeaf(next->next);
+      if (next->kv_num > 0 && sameEntry(next->keyvalues[0], kv)) return true;
+    }
+    if (!unique_key) return false;
+    if (pos > 0) return sameEntry(leaf->keyvalues[pos - 1], kv);
+    if (leaf->prev == -1) return false;
+    LeafHandle prev = pinLeaf(leaf->prev);
+    while (prev->kv_num == 0 && prev->prev != -1) prev = pinLeaf(prev->prev);
+    return prev->kv_num > 0 && sameEntry(prev->keyvalues[prev->kv_num - 1], kv);
+  }
+
+  //批量操作前把键值对排好序（自底向上归并）
+  static void sortBatch(sjtu::vector<KeyValue<T, K>>& kvs) {
+    int n = kvs.size();
+    if (n < 2) return;
+    sjtu::vector<KeyValue<T, K>> tmp = kvs;
+    sjtu::vector<KeyValue<T, K>>* src = &kvs;
+    sjtu::vector<KeyValue<T, K>>* dst = &tmp;
+    for (int width = 1; width < n; width *= 2) {
+      for (int lo = 0; lo < n; lo += 2 * width) {
+        int mid = lo + width < n ? lo + width : n;
+        int hi = lo + 2 * width < n ? lo + 2 * width : n;
+        int a = lo, b = mid, k = lo;
+        while (a < mid && b < hi) {
+          (*dst)[k++] = (*src)[b] < (*src)[a] ? (*src)[b++] : (*src)[a++];
         }
+        while (a < mid) (*dst)[k++] = (*src)[a++];
+        while (b < hi) (*dst)[k++] = (*src)[b++];
       }
-      int pos = 0;
-      while (pos < cur.kv_num && cur.keyvalues[pos] < kv) ++pos;
-      for (int i = cur.kv_num; i > pos; --i) {
-        cur.keyvalues[i] = cur.keyvalues[i - 1];
-        cur.child_offset[i] = cur.child_offset[i - 1];
-      }
-      cur.keyvalues[pos] = kv;
-      cur.kv_num++;
-      basic_info.total_num++;
-      writeNode(cur);
-      if (cur.kv_num > SIZE) splitNode(cur);
-      updateInfo();
+      sjtu::vector<KeyValue<T, K>>* t = src;
+      src = dst;
+      dst = t;
     }
+    if (src != &kvs) kvs = tmp;
   }
 
-  bool find_pair(const Key& key, const T& value) {
-    if (basic_info.total_num == 0) {
-      return false;
-    }
-    KeyValue<T> kv(key, value);
-    IndexNode<T, SIZE> cur = readNode(basic_info.root);
-    while (cur.is_leaf == false) {
-      int idx = 0;
-      while (idx < cur.kv_num && kv >= cur.keyvalues[idx]) {
-        idx++;
+  //把n个元素按顺序均匀分成group组，返回第i个元素所在的组
+  static int groupOf(int i, int n, int group) {
+    int base = n / group, rem = n % group;
+    if (i < rem * (base + 1)) return i / (base + 1);
+    return rem + (i - rem * (base + 1)) / base;
+  }
+
+  //均匀分组时第g组的元素个数
+  static int groupSize(int g, int n, int group) {
+    return n / group + (g < n % group ? 1 : 0);
+  }
+
+  //在叶子中删除kv，找不到时再检查前一个叶子的末尾
+  //removed不为空时把被删除的value存进去
+  bool eraseInLeaf(const KeyValue<T, K>& kv, bool merge, T* removed) {
+    LeafHandle cur = descend(kv, true);
+    int ErasePos = lowerBound(*cur, kv);
+    if (ErasePos == cur->kv_num || cur->keyvalues[ErasePos] != kv) ErasePos = -1;
+    if (ErasePos == -1 && cur->prev != -1) {
+      cur = pinLeaf(cur->prev);
+      if (cur->kv_num > 0 && cur->keyvalues[cur->kv_num - 1] == kv) {
+        ErasePos = cur->kv_num - 1;
       }
-      cur = readNode(cur.child_offset[idx]);
     }
-    for (int i = 0; i < cur.kv_num; ++i) {
-      if (cur.keyvalues[i] == kv) {
-        return true;
-      } else if (cur.keyvalues[i] > kv) {
-        break;
-      }
+    if (ErasePos == -1) {
+      return false;
+    }
+    if (removed) *removed = cur->keyvalues[ErasePos].value;
+    for (int i = ErasePos; i < cur->kv_num - 1; ++i) {
+      cur->keyvalues[i] = cur->keyvalues[i + 1];
     }
-    //very important
-    cur = readNode(cur.prev);
-    if (cur.keyvalues[cur.kv_num - 1] == kv) {
+    --cur->kv_num;
+    --basic_info.total_num;
+    //树已经空了，剩下的节点全部作废，直接截断文件
+    if (basic_info.total_num == 0) {
+      cur.release();
+      resetTree();
       return true;
     }
-    return false;
+    cur.markDirty();
+    if (merge && cur->kv_num < (SIZE + 1) / 2) {
+      mergeLeaf(cur);
+    }
+    updateInfo();
+    return true;
   }
 
-  //查找所有key对应的value，并且存在一个Vector里
-  sjtu::vector<T> find_all(const Key& key) {
-    //std::cout << "find_all" << key << std::endl;
-    /*sjtu::map<T, T> res;
-    sjtu::vector<T> ans;
-    if (basic_info.total_num == 0) {
-      return ans;
-    }
-    IndexNode<T, SIZE> cur = readNode(basic_info.root);
-    while (cur.is_leaf == false) {
-      int idx = 0;
-      while (idx < cur.kv_num && key >= cur.keyvalues[idx].key) {
-        idx++;
-      }
-      cur = readNode(cur.child_offset[idx]);
-    }
-    bool found = false;
-    for (int i = 0; i < cur.kv_num; ++i) {
-      if (cur.keyvalues[i].key == key) {
-        T haha = cur.keyvalues[i].value;
-        res.insert({haha, haha});
-        found = true;
-      } else if (found && cur.keyvalues[i].key > key) {
-        break;
+public:
+  /*
+  游标：沿叶子链表双向遍历键值对
+  越过最后一个元素后停在末尾，越过第一个元素后停在开头之前，都可以再往回走
+  单线程使用时游标pin住所在的叶子，存活期间不能修改这棵树
+  多线程访问时游标不pin叶子，也不持有任何锁，拿着叶子的乐观拷贝(见descendSnapshot)，其他线程可以同时修改这棵树；
+  走出拷贝时再拷贝相邻的叶子，树收缩过就按走过的最后一个元素重新定位
+  拷贝归游标所有，所以游标只能移动不能拷贝
+  */
+  class Cursor {
+    friend class BPlusTree;
+
+  private:
+    BPlusTree* tree = nullptr;
+    LeafHandle leaf;
+    const Leaf* node = nullptr;       //所在的叶子，乐观读时指向snap
+    Leaf* snap = nullptr;             //乐观读时叶子的拷贝
+    unsigned epoch = 0;               //乐观读定位时的shrinks
+    int pos = 0;
+
+    //pos越过叶子末尾时移到下一个非空叶子，已经是最后一个叶子时停在末尾
+    //乐观读时树收缩过就返回false，由调用者重新定位
+    bool skipForward() {
+      while (pos >= node->kv_num && node->next != -1) {
+        if (snap) {
+          if (!tree->snapshotNext(*snap, epoch)) return false;
+        } else {
+          leaf = tree->pinSibling(node->next);
+          node = &*leaf;
+        }
+        pos = 0;
       }
+      return true;
     }
-    IndexNode<T, SIZE> temp_cur = cur;
-    while (true) {
-      if (cur.next != -1) {
-        IndexNode<T, SIZE> next_node = readNode(cur.next);
-        if (next_node.kv_num > 0 && next_node.keyvalues[0].key == key) {
-          cur = next_node;
-          for (int i = 0; i < cur.kv_num; ++i) {
-            if (cur.keyvalues[i].key == key) {
-              T haha = cur.keyvalues[i].value;
-              res.insert({haha, haha});
-            } else if (cur.keyvalues[i].key > key) {
-              break;
-            }
-          }
+    bool skipBackward() {
+      while (pos < 0 && node->prev != -1) {
+        if (snap) {
+          if (!tree->snapshotPrev(*snap, epoch)) return false;
         } else {
-          break;
+          leaf = tree->pinLeaf(node->prev);
+          node = &*leaf;
         }
-      } else {
-        break;
+        pos = node->kv_num - 1;
       }
+      return true;
     }
-    cur = temp_cur;
-    while (true) {
-      if (cur.prev != -1) {
-        IndexNode<T, SIZE> prev_node = readNode(cur.prev);
-        if (prev_node.kv_num > 0 && prev_node.keyvalues[prev_node.kv_num - 1].key == key) {
-          cur = prev_node;
-          for (int i = prev_node.kv_num - 1; i >= 0; --i) {
-            if (prev_node.keyvalues[i].key == key) {
-              T haha = prev_node.keyvalues[i].value;
-              res.insert({haha, haha});
-            } else if (prev_node.keyvalues[i].key < key) {
-              break;
-            }
-          }
-        } else {
-          break;
+
+    //乐观读时定位：sep_before(sep)为真时往右子树走，停在第一个kv_before为假的元素上
+    //与分隔键相等的元素可能在左右两个叶子中，走到右边的叶子后还要接着跳过kv_before为真的元素
+    template<class SepBefore, class KvBefore>
+    void seekSnapshot(SepBefore sep_before, KvBefore kv_before) {
+      for (;;) {
+        if (!tree->descendSnapshot(sep_before, *snap, epoch)) {
+          node = nullptr;
+          return;
+        }
+        node = snap;
+        for (;;) {
+          pos = searchNode(snap->kv_num, [&](int i) { return kv_before(snap->keyvalues[i]); });
+          if (pos < snap->kv_num || snap->next == -1) return;
+          if (!tree->snapshotNext(*snap, epoch)) break;
         }
-      } else {
-        break;
       }
     }
-    for (auto it = res.begin(); it != res.end(); it++) {
-      ans.push_back(it->second);
+    //第一个不小于kv的元素
+    void seekAt(const KeyValue<T, K>& kv) {
+      seekSnapshot([&kv](const Sep& sep) { return compareSep(kv, sep) > 0; },
+                   [&kv](const KeyValue<T, K>& cur) { return cur < kv; });
     }
-    return ans;*/
-    sjtu::vector<T> ans;
-    if (basic_info.total_num == 0) {
-      return ans;
-    }
-    IndexNode<T, SIZE> cur = readNode(basic_info.root);
-    while (cur.is_leaf == false) {
-      int left = 0;
-      int right = cur.kv_num;
-      while (left < right) {
-        int mid = left + (right - left) / 2;
-        if (key > cur.keyvalues[mid].key) {
-          left = mid + 1;
-        } else {
-          right = mid;
-        }
+    //第一个大于kv的元素
+    void seekAfter(const KeyValue<T, K>& kv) {
+      seekSnapshot([&kv](const Sep& sep) { return compareSep(kv, sep) > 0; },
+                   [&kv](const KeyValue<T, K>& cur) { return !(kv < cur); });
+    }
+
+  public:
+    Cursor() = default;
+    Cursor(BPlusTree* _tree, LeafHandle _leaf, int _pos) : tree(_tree), leaf(std::move(_leaf)), pos(_pos) {
+      if (!leaf.valid()) return;
+      node = &*leaf;
+      skipForward();
+    }
+    //乐观读的游标，由树定位；snap只用来存放拷贝，内容都由copyLeaf写入，不需要构造
+    explicit Cursor(BPlusTree* _tree) : tree(_tree), snap(static_cast<Leaf*>(::operator new(sizeof(Leaf)))) {}
+    Cursor(Cursor&& other) noexcept :
+    tree(other.tree), leaf(std::move(other.leaf)), node(other.node), snap(other.snap), epoch(other.epoch), pos(other.pos) {
+      other.node = nullptr;
+      other.snap = nullptr;
+    }
+    Cursor& operator=(Cursor&& other) noexcept {
+      if (this == &other) return *this;
+      ::operator delete(snap);
+      tree = other.tree;
+      leaf = std::move(other.leaf);
+      node = other.node;
+      snap = other.snap;
+      epoch = other.epoch;
+      pos = other.pos;
+      other.node = nullptr;
+      other.snap = nullptr;
+      return *this;
+    }
+    Cursor(const Cursor&) = delete;
+    Cursor& operator=(const Cursor&) = delete;
+    ~Cursor() {
+      ::operator delete(snap);
+    }
+
+    bool valid() const {
+      return node && pos >= 0 && pos < node->kv_num;
+    }
+    const K& key() const {
+      return node->keyvalues[pos].key;
+    }
+    const T& value() const {
+      return node->keyvalues[pos].value;
+    }
+    const KeyValue<T, K>& operator*() const {
+      return node->keyvalues[pos];
+    }
+    void next() {
+      if (!node || pos >= node->kv_num) return;
+      //要走出拷贝时先记下当前元素，树收缩过就从它之后重新定位
+      if (snap && pos + 1 == node->kv_num) {
+        KeyValue<T, K> last = node->keyvalues[pos];
+        ++pos;
+        if (!skipForward()) seekAfter(last);
+        return;
       }
-      int idx = left; 
-      cur = readNode(cur.child_offset[idx]);
-    }
-    int idx = 0;
-    while (true) {
-      if (idx < cur.kv_num && cur.keyvalues[idx].key <= key) {
-        if (cur.keyvalues[idx].key == key) ans.push_back(cur.keyvalues[idx].value);
-        idx++;
-      } else if (idx >= cur.kv_num) {
-        IndexNode<T, SIZE> next_node = readNode(cur.next);
-        if (next_node.kv_num > 0 && next_node.keyvalues[0].key <= key) {
-          cur = next_node;
-          idx = 0;
+      ++pos;
+      skipForward();
+    }
+    void prev() {
+      if (!node || pos < 0) return;
+      //要走出拷贝时先记下当前元素(停在空叶子的末尾时没有)，树收缩过就回到它的位置再往回走
+      if (snap && pos == 0) {
+        bool at_end = node->kv_num == 0;
+        KeyValue<T, K> first;
+        if (!at_end) first = node->keyvalues[0];
+        --pos;
+        if (skipBackward()) return;
+        if (at_end) {
+          seekSnapshot([](const Sep&) { return true; }, [](const KeyValue<T, K>&) { return true; });
         } else {
-          //std::cout << "1" << std::endl;
-          break;
+          seekAt(first);
         }
-      } else {
-          //std::cout << "2" << std::endl;
-        break;
+        prev();
+        return;
       }
+      --pos;
+      skipBackward();
     }
-    return ans;
+  };
+
+private:
+  //按key定位游标，upper为false时停在第一个不小于key的元素，否则停在第一个大于key的元素
+  Cursor seek(const K& key, bool upper) {
+    auto before = [&key, upper](const K& cur) {
+      int res = compareKey(key, cur);
+      return upper ? res >= 0 : res > 0;
+    };
+    if (concurrent) {
+      Cursor it(this);
+      it.seekSnapshot([&before](const Sep& sep) { return before(sep.key); },
+                      [&before](const KeyValue<T, K>& kv) { return before(kv.key); });
+      return it;
+    }
+    if (basic_info.root == -1) return Cursor();
+    int offset = basic_info.root;
+    bool leaf = basic_info.root_is_leaf;
+    while (!leaf) {
+      InnerHandle node = pinInner(offset);
+      int left = searchNode(node->kv_num, [&](int i) { return before(node->keys[i].key); });
+      offset = node->child_offset[left];
+      leaf = node->leaf_children;
+    }
+    LeafHandle cur = pinLeaf(offset);
+    int left = searchNode(cur->kv_num, [&](int i) { return before(cur->keyvalues[i].key); });
+    return Cursor(this, std::move(cur), left);
   }
- 
-  //删除key和对应的value
-  bool erase(const Key& key, const T& value) {
-    if (basic_info.total_num == 0) {
-      return false;
+
+public:
+  //第一个键不小于key的位置
+  Cursor lower_bound(const K& key) {
+    return seek(key, false);
+  }
+
+  //第一个键大于key的位置，往回走一步就是key的最后一个元素
+  Cursor upper_bound(const K& key) {
+    return seek(key, true);
+  }
+
+  //第一个元素
+  Cursor begin() {
+    if (concurrent) {
+      Cursor it(this);
+      it.seekSnapshot([](const Sep&) { return false; }, [](const KeyValue<T, K>&) { return false; });
+      return it;
+    }
+    if (basic_info.root == -1) return Cursor();
+    return Cursor(this, firstLeaf(), 0);
+  }
+
+  //key对应的元素个数
+  int count(const K& key) {
+    if (unique_key) return contains(key) ? 1 : 0;
+    int num = 0;
+    for (Cursor it = lower_bound(key); it.valid() && compareKey(it.key(), key) == 0; it.next()) ++num;
+    return num;
+  }
+
+  //传入wal时两个文件的修改都写进日志
+  BPlusTree(string base_filename, WriteAheadLog* _wal = nullptr) :
+  file_name(base_filename), wal(_wal), LeafFile(base_filename), InnerFile(base_filename + "_inner"),
+  leaf_cache(LeafFile), inner_cache(InnerFile) {
+    bool leaf_existed = LeafFile.open();
+    bool inner_existed = InnerFile.open();
+    //两个文件缺一个时按空树重新建立
+    if (!leaf_existed || !inner_existed) {
+      LeafFile.initialise();
+      InnerFile.initialise();
+      basic_info = BPT_Meta();
+      basic_info.write_offset = node_begin;
+      basic_info.inner_write_offset = node_begin;
+      updateInfo();
+      updateInnerInfo();
+    } else {
+      readInfo();
     }
-    KeyValue<T> kv(key, value);
-    IndexNode<T, SIZE> cur = readNode(basic_info.root);
-    while (cur.is_leaf == false) {
-      int left = 0, right = cur.kv_num;
-      while (left < right) {
-        int mid = left + (right - left) / 2;
-        if (kv >= cur.keyvalues[mid]) {
-          left = mid + 1;
-        } else {
-          right = mid;
-        }
-      }
-      int idx = left;
-      cur = readNode(cur.child_offset[idx]);
-    }
-    int ErasePos = -1;
-    int left = 0, right = cur.kv_num - 1;
-    while (left <= right) {
-      int mid = (left + right) / 2;
-      if (cur.keyvalues[mid] == kv) {
-        ErasePos = mid;
-        break;
-      } else if (cur.keyvalues[mid] < kv) {
-        left = mid + 1;
-      } else {
-        right = mid - 1;
-      }
+    if (wal) {
+      LeafFile.attach(wal);
+      InnerFile.attach(wal);
+      leaf_cache.attach(wal);
+      inner_cache.attach(wal);
     }
-    if (ErasePos == -1) {
-      cur = readNode(cur.prev);
-      if (cur.keyvalues[cur.kv_num - 1] == kv) {
-        ErasePos = cur.kv_num - 1;
-      }
+  };
+
+  ~BPlusTree() {
+    leaf_cache.flush();
+    leaf_cache.drop();
+    inner_cache.flush();
+    inner_cache.drop();
+    LeafFile.close();
+    InnerFile.close();
+  };
+
+  //写回脏节点并将文件落盘
+  void flush() {
+    std::unique_lock<RWLatch> guard = exclusiveGuard();
+    leaf_cache.flush();
+    inner_cache.flush();
+    LeafFile.flush();
+    InnerFile.flush();
+  }
+
+  //开启两个节点缓存的后台写回，见BufferPool::start_writer
+  void start_writer(int pages_per_second) {
+    leaf_cache.start_writer(pages_per_second);
+    inner_cache.start_writer(pages_per_second);
+  }
+
+  /*
+  允许多个线程同时使用这棵树，只能在没有其他线程使用时切换
+  插入、删除和update先共享树的结构锁，只给目标叶子加写锁原地修改，
+  要分裂、合并或者要看相邻的叶子时才独占整棵树，所以落在不同叶子上的修改可以同时进行
+  查找和游标不加锁，乐观地读(见descendSnapshot)，不会挡住修改，只在树结构正被改变时等它改完
+  接入写前日志时，提交仍然要在没有操作进行时调用
+  只对这棵树本身有效：HeapBPlusTree没有这个接口，它的RecordHeap完全不加锁，只能单线程使用
+  */
+  void set_concurrent(bool on) {
+    concurrent = on;
+    leaf_cache.set_shared(on);
+    inner_cache.set_shared(on);
+  }
+
+  //向BPT中插入key_value键值对，只下降一次，在找插入位置的同时检查是否重复
+  //返回是否插入，已经存在时返回false
+  bool insert(const K& key, T& value) {
+    KeyValue<T, K> kv(key, value);
+    if (concurrent) {
+      std::shared_lock<RWLatch> guard(structure);
+      int res = insertInLeaf(kv);
+      if (res != -1) return res;
+    }
+    std::unique_lock<RWLatch> guard = exclusiveGuard();
+    return insertOne(kv);
+  }
+
+private:
+  //调用者独占整棵树
+  bool insertOne(const KeyValue<T, K>& kv) {
+    if (basic_info.total_num == 0) {
+      LeafHandle root = newLeaf();
+      root->kv_num = 1;
+      root->keyvalues[0] = kv;
+      basic_info.root = root->offset;
+      basic_info.root_is_leaf = 1;
+      basic_info.total_num = 1;
+      updateInfo();
+      return true;
     }
-    if (ErasePos == -1) {
-      //std::cout << "pair not found" << std::endl;
-      return false;
+    Sep upper;
+    bool bounded = false;
+    LeafHandle cur = descend(kv, false, &upper, &bounded);
+    int pos = lowerBound(*cur, kv);
+    if (duplicateAt(cur, pos, kv, upper, bounded)) return false;
+    for (int i = cur->kv_num; i > pos; --i) {
+      cur->keyvalues[i] = cur->keyvalues[i - 1];
+    }
+    cur->keyvalues[pos] = kv;
+    cur->kv_num++;
+    basic_info.total_num++;
+    cur.markDirty();
+    if (cur->kv_num > SIZE) splitLeaf(cur);
+    updateInfo();
+    return true;
+  }
+
+  /*
+  多线程访问时的原地修改：共享结构锁，只给目标叶子加写锁，返回1表示改好了，0表示重复或者找不到
+  要分裂、合并、清空或者要看相邻的叶子时什么都不改，返回-1，由调用者独占整棵树之后重做
+  共享结构锁期间内部节点不会改变，下降得到的叶子一直是kv所在的叶子
+  */
+  int insertInLeaf(const KeyValue<T, K>& kv) {
+    if (basic_info.root == -1) return -1;
+    Sep upper;
+    bool bounded = false;
+    LeafHandle cur = descend(kv, false, &upper, &bounded, LatchMode::Exclusive);
+    if (cur->kv_num >= SIZE) return -1;
+    int pos = lowerBound(*cur, kv);
+    //这两种情况下duplicateAt要去看相邻的叶子
+    if (pos == cur->kv_num && bounded && sameSep(kv, upper)) return -1;
+    if (unique_key && pos == 0 && cur->prev != -1) return -1;
+    if (duplicateAt(cur, pos, kv, upper, bounded)) return 0;
+    for (int i = cur->kv_num; i > pos; --i) {
+      cur->keyvalues[i] = cur->keyvalues[i - 1];
+    }
+    cur->keyvalues[pos] = kv;
+    cur->kv_num++;
+    cur.markDirty();
+    std::lock_guard<std::mutex> lock(meta);
+    basic_info.total_num++;
+    updateInfo();
+    return 1;
+  }
+
+  int eraseInPlace(const KeyValue<T, K>& kv, bool merge, T* removed) {
+    if (basic_info.root == -1) return 0;
+    LeafHandle cur = descend(kv, true, nullptr, nullptr, LatchMode::Exclusive);
+    int pos = lowerBound(*cur, kv);
+    if (pos == cur->kv_num || cur->keyvalues[pos] != kv) return cur->prev == -1 ? 0 : -1;
+    if (merge && cur->parent != -1 && cur->kv_num - 1 < (SIZE + 1) / 2) return -1;
+    {
+      std::lock_guard<std::mutex> lock(meta);
+      if (basic_info.total_num <= 1) return -1;
+      --basic_info.total_num;
+      updateInfo();
     }
-    /*std::cout << "erase node:" << std::endl;
-    for (int i = 0; i < cur.kv_num; ++i) {
-      std::cout << cur.keyvalues[i] << " ";
+    if (removed) *removed = cur->keyvalues[pos].value;
+    for (int i = pos; i < cur->kv_num - 1; ++i) {
+      cur->keyvalues[i] = cur->keyvalues[i + 1];
     }
-    std::cout << std::endl;
-    std::cout << "ErasePos: " << ErasePos << std::endl;*/
-    for (int i = ErasePos; i < cur.kv_num - 1; ++i) {
-      cur.keyvalues[i] = cur.keyvalues[i + 1];
-      cur.child_offset[i] = cur.child_offset[i + 1];
+    --cur->kv_num;
+    cur.markDirty();
+    return 1;
+  }
+
+  bool eraseOne(const KeyValue<T, K>& kv, bool merge, T* removed) {
+    if (concurrent) {
+      std::shared_lock<RWLatch> guard(structure);
+      int res = eraseInPlace(kv, merge, removed);
+      if (res != -1) return res;
+    }
+    std::unique_lock<RWLatch> guard = exclusiveGuard();
+    if (basic_info.total_num == 0) return false;
+    return eraseInLeaf(kv, merge, removed);
+  }
+
+  //bulk_load写完节点之后写入文件头，接入日志时先让节点落盘，叶子文件头最后写
+  void writeLoadedInfo() {
+    if (!wal) {
+      updateInfo();
+      updateInnerInfo();
+      return;
     }
-    if (cur.kv_num != 0) {
-      cur.keyvalues[cur.kv_num - 1] = KeyValue<T>();
-      cur.child_offset[cur.kv_num - 1] = -1;
+    LeafFile.sync_durable();
+    InnerFile.sync_durable();
+    int inner_info[2] = {basic_info.inner_write_offset, basic_info.inner_free_head};
+    InnerFile.write_all_info_durable(inner_info);
+    int info[5] = {basic_info.root, basic_info.total_num, basic_info.write_offset,
+                   basic_info.free_head, basic_info.root_is_leaf};
+    LeafFile.write_all_info_durable(info);
+  }
+
+  //清空整棵树并截断文件，调用者独占整棵树
+  //缓存中的页全部丢弃，要先等乐观读的读者放开它们pin住的页
+  void resetTree() {
+    ++shrinks;
+    if (concurrent) readers.wait_empty();
+    leaf_cache.drop();
+    inner_cache.drop();
+    LeafFile.clear();
+    InnerFile.clear();
+    basic_info = BPT_Meta();
+    basic_info.write_offset = node_begin;
+    basic_info.inner_write_offset = node_begin;
+    updateInfo();
+    updateInnerInfo();
+  }
+
+public:
+  //用按KeyValue顺序排好的键值对自底向上建树，树中原有的内容会被清空，重复的键值对只保留一个
+  //kvs没有排好序时返回false，树保持原样
+  //叶子和内部节点都尽量填满，各层节点依次顺序写入文件，不经过cache
+  //接入写前日志时先让日志做检查点，节点不写日志，全部落盘之后最后写叶子文件头，
+  //中途断电时叶子文件头还是截断后的默认值，树是空的
+  bool bulk_load(const sjtu::vector<KeyValue<T, K>>& kvs) {
+    std::unique_lock<RWLatch> guard = exclusiveGuard();
+    for (int i = 1; i < (int)kvs.size(); ++i) {
+      if (unique_key ? compareKey(kvs[i].key, kvs[i - 1].key) < 0 : kvs[i] < kvs[i - 1]) return false;
+    }
+    if (wal) {
+      wal->drain();
+      ++shrinks;
+      if (concurrent) readers.wait_empty();
+      leaf_cache.drop();
+      inner_cache.drop();
+      LeafFile.truncate_durable();
+      InnerFile.truncate_durable();
+    } else {
+      resetTree();
+    }
+    basic_info = BPT_Meta();
+    basic_info.write_offset = node_begin;
+    basic_info.inner_write_offset = node_begin;
+    sjtu::vector<int> pos;            //不重复的键值对在kvs中的下标
+    for (int i = 0; i < (int)kvs.size(); ++i) {
+      if (i == 0 || !sameEntry(kvs[i], kvs[i - 1])) pos.push_back(i);
+    }
+    int n = pos.size();
+    if (n == 0) {
+      writeLoadedInfo();
+      return true;
     }
-    --cur.kv_num;
-    --basic_info.total_num;
-    if (basic_info.total_num == 0) {
-      basic_info.root = -1;
+    const int node_len = PAGE;        //每个节点占一页
+
+    //自底向上每层的节点数和起始偏移量，第0层是叶子，其余各层在内部节点文件中
+    sjtu::vector<int> count, start;
+    count.push_back((n + SIZE - 1) / SIZE);
+    start.push_back(node_begin);
+    while (count.back() > 1) {
+      int below = count.back();
+      start.push_back(count.size() == 1 ? node_begin : start.back() + below * node_len);
+      count.push_back((below + INNER_SIZE) / (INNER_SIZE + 1));
+    }
+    int top = count.size() - 1;
+    auto parentOf = [&](int level, int j) {
+      if (level == top) return -1;
+      return start[level + 1] + groupOf(j, count[level], count[level + 1]) * node_len;
+    };
+
+    Leaf* leaf = new Leaf;
+    sjtu::vector<Sep> first;          //当前层每个节点的第一个分隔键
+    int cur = 0;
+    for (int g = 0; g < count[0]; ++g) {
+      int offset = start[0] + g * node_len;
+      resetLeaf(*leaf, offset);
+      leaf->parent = parentOf(0, g);
+      leaf->prev = g > 0 ? offset - node_len : -1;
+      leaf->next = g + 1 < count[0] ? offset + node_len : -1;
+      leaf->kv_num = groupSize(g, n, count[0]);
+      for (int i = 0; i < leaf->kv_num; ++i) {
+        leaf->keyvalues[i] = kvs[pos[cur++]];
+      }
+      first.push_back(toSep(leaf->keyvalues[0]));
+      LeafFile.writeT(*leaf, offset);
     }
-    writeNode(cur);
-    if (cur.kv_num >= 0 && cur.kv_num < (SIZE + 1) / 2) {
-      //std::cout << "merge" << std::endl;
-      mergeNode(cur);
+    delete leaf;
+
+    Inner* node = new Inner;
+    for (int level = 1; level <= top; ++level) {
+      sjtu::vector<Sep> upper;
+      int child = 0;
+      for (int g = 0; g < count[level]; ++g) {
+        int offset = start[level] + g * node_len;
+        resetInner(*node, offset);
+        node->leaf_children = level == 1;
+        node->parent = parentOf(level, g);
+        int child_num = groupSize(g, count[level - 1], count[level]);
+        node->kv_num = child_num - 1;
+        for (int i = 0; i < child_num; ++i) {
+          node->child_offset[i] = start[level - 1] + (child + i) * node_len;
+          if (i > 0) node->keys[i - 1] = first[child + i];
+        }
+        upper.push_back(first[child]);
+        child += child_num;
+        InnerFile.writeT(*node, offset);
+      }
+      first = upper;
     }
-    updateInfo();
+    delete node;
+
+    basic_info.root = start[top];
+    basic_info.root_is_leaf = top == 0;
+    basic_info.total_num = n;
+    basic_info.write_offset = node_begin + count[0] * node_len;
+    basic_info.inner_write_offset = top > 0 ? start[top] + count[top] * node_len : node_begin;
+    writeLoadedInfo();
     return true;
   }
 
-  bool erase_without_merge(const Key& key, const T& value) {
-    if (basic_info.total_num == 0) {
-      return false;
+  //批量插入：排序之后，落在同一个叶子中的键值对在一次下降中全部插入
+  //叶子溢出时才分裂，剩下的键值对重新下降
+  void insert_batch(sjtu::vector<KeyValue<T, K>> kvs) {
+    std::unique_lock<RWLatch> guard = exclusiveGuard();
+    sortBatch(kvs);
+    int n = kvs.size(), i = 0;
+    while (i < n) {
+      if (i > 0 && sameEntry(kvs[i], kvs[i - 1])) {
+        ++i;
+        continue;
+      }
+      if (basic_info.total_num == 0) {
+        insertOne(kvs[i]);
+        ++i;
+        continue;
+      }
+      Sep upper;
+      bool bounded = false;
+      LeafHandle cur = descend(kvs[i], false, &upper, &bounded);
+      bool split = false;
+      while (i < n && (!bounded || compareSep(kvs[i], upper) <= 0)) {
+        if (i > 0 && sameEntry(kvs[i], kvs[i - 1])) {
+          ++i;
+          continue;
+        }
+        int pos = lowerBound(*cur, kvs[i]);
+        if (!duplicateAt(cur, pos, kvs[i], upper, bounded)) {
+          for (int j = cur->kv_num; j > pos; --j) {
+            cur->keyvalues[j] = cur->keyvalues[j - 1];
+          }
+          cur->keyvalues[pos] = kvs[i];
+          cur->kv_num++;
+          basic_info.total_num++;
+          cur.markDirty();
+        }
+        ++i;
+        if (cur->kv_num > SIZE) {
+          split = true;
+          break;
+        }
+      }
+      if (split) splitLeaf(cur);
     }
-    KeyValue<T> kv(key, value);
-    IndexNode<T, SIZE> cur = readNode(basic_info.root);
-    while (cur.is_leaf == false) {
-      int left = 0, right = cur.kv_num;
-      while (left < right) {
-        int mid = left + (right - left) / 2;
-        if (kv >= cur.keyvalues[mid]) {
-          left = mid + 1;
+    updateInfo();
+  }
+
+  //批量删除：排序之后，落在同一个叶子中的键值对在一次下降中全部删除
+  //一个叶子处理完之后才合并，在叶子中找不到的键值对最后按单个删除的方式再处理一次
+  void erase_batch(sjtu::vector<KeyValue<T, K>> kvs, bool merge = true) {
+    std::unique_lock<RWLatch> guard = exclusiveGuard();
+    sortBatch(kvs);
+    sjtu::vector<KeyValue<T, K>> missed;
+    int n = kvs.size(), i = 0;
+    while (i < n && basic_info.total_num > 0) {
+      Sep upper;
+      bool bounded = false;
+      LeafHandle cur = descend(kvs[i], true, &upper, &bounded);
+      bool changed = false;
+      while (i < n && (!bounded || compareSep(kvs[i], upper) < 0)) {
+        //删除只按完整的键值对匹配，唯一键模式下同一个key的另一个value也要去找
+        if (i > 0 && kvs[i] == kvs[i - 1]) {
+          ++i;
+          continue;
+        }
+        int pos = lowerBound(*cur, kvs[i]);
+        if (pos < cur->kv_num && cur->keyvalues[pos] == kvs[i]) {
+          for (int j = pos; j < cur->kv_num - 1; ++j) {
+            cur->keyvalues[j] = cur->keyvalues[j + 1];
+          }
+          --cur->kv_num;
+          --basic_info.total_num;
+          changed = true;
         } else {
-          right = mid;
+          missed.push_back(kvs[i]);
         }
+        ++i;
       }
-      int idx = left;
-      cur = readNode(cur.child_offset[idx]);
-    }
-    int ErasePos = -1;
-    int left = 0, right = cur.kv_num - 1;
-    while (left <= right) {
-      int mid = (left + right) / 2;
-      if (cur.keyvalues[mid] == kv) {
-        ErasePos = mid;
-        break;
-      } else if (cur.keyvalues[mid] < kv) {
-        left = mid + 1;
-      } else {
-        right = mid - 1;
+      if (!changed) continue;
+      if (basic_info.total_num == 0) {
+        cur.release();
+        resetTree();
+        return;
       }
-    }
-    if (ErasePos == -1) {
-      cur = readNode(cur.prev);
-      if (cur.keyvalues[cur.kv_num - 1] == kv) {
-        ErasePos = cur.kv_num - 1;
+      cur.markDirty();
+      if (merge && cur->kv_num < (SIZE + 1) / 2) {
+        mergeLeaf(cur);
       }
     }
-    if (ErasePos == -1) {
-      //std::cout << "pair not found" << std::endl;
-      return false;
-    }
-    /*std::cout << "erase node:" << std::endl;
-    for (int i = 0; i < cur.kv_num; ++i) {
-      std::cout << cur.keyvalues[i] << " ";
+    for (int j = 0; j < (int)missed.size() && basic_info.total_num > 0; ++j) {
+      eraseInLeaf(missed[j], merge, nullptr);
     }
-    std::cout << std::endl;
-    std::cout << "ErasePos: " << ErasePos << std::endl;*/
-    for (int i = ErasePos; i < cur.kv_num - 1; ++i) {
-      cur.keyvalues[i] = cur.keyvalues[i + 1];
-      cur.child_offset[i] = cur.child_offset[i + 1];
+    updateInfo();
+  }
+
+  //found不为空时存入树中与value相等的那个value
+  bool find_pair(const K& key, const T& value, T* found = nullptr) {
+    KeyValue<T, K> kv(key, value);
+    //多线程访问时乐观地找第一个不小于kv的元素
+    if (concurrent) {
+      Cursor it(this);
+      it.seekAt(kv);
+      if (!it.valid() || !(*it == kv)) return false;
+      if (found) *found = it.value();
+      return true;
     }
-    if (cur.kv_num != 0) {
-      cur.keyvalues[cur.kv_num - 1] = KeyValue<T>();
-      cur.child_offset[cur.kv_num - 1] = -1;
+    int pos;
+    LeafHandle cur = locate(kv, pos);
+    if (!cur.valid()) return false;
+    if (found) *found = cur->keyvalues[pos].value;
+    return true;
+  }
+
+  //原地修改key下与value相等的那个value，返回是否找到
+  //mutator接受T&，不能改变它与其他value之间的大小关系
+  template<class Mutator>
+  bool update(const K& key, const T& value, Mutator mutator) {
+    KeyValue<T, K> kv(key, value);
+    int pos;
+    //多线程访问时先只锁住目标叶子，要去前一个叶子找时再独占整棵树
+    if (concurrent) {
+      std::shared_lock<RWLatch> guard(structure);
+      if (basic_info.root == -1) return false;
+      LeafHandle cur = descend(kv, true, nullptr, nullptr, LatchMode::Exclusive);
+      pos = lowerBound(*cur, kv);
+      if (pos < cur->kv_num && cur->keyvalues[pos] == kv) {
+        mutator(cur->keyvalues[pos].value);
+        cur.markDirty();
+        return true;
+      }
+      if (cur->prev == -1) return false;
     }
-    --cur.kv_num;
-    --basic_info.total_num;
-    if (basic_info.total_num == 0) {
-      basic_info.root = -1;
+    std::unique_lock<RWLatch> guard = exclusiveGuard();
+    LeafHandle cur = locate(kv, pos);
+    if (!cur.valid()) return false;
+    mutator(cur->keyvalues[pos].value);
+    cur.markDirty();
+    return true;
+  }
+
+  //已经存在与value相等的value时用value覆盖它，否则插入，返回是否是新插入的
+  bool upsert(const K& key, T& value) {
+    if (update(key, value, [&value](T& old) { old = value; })) return false;
+    insert(key, value);
+    return true;
+  }
+
+  //查找所有key对应的value，并且存在一个Vector里
+  sjtu::vector<T> find_all(const K& key) {
+    sjtu::vector<T> ans;
+    for (Cursor it = lower_bound(key); it.valid() && compareKey(it.key(), key) == 0; it.next()) {
+      ans.push_back(it.value());
+      if (unique_key) break;
     }
-    writeNode(cur);
-    updateInfo();
+    return ans;
+  }
+
+  //返回指向key的第一个元素的游标，找不到时游标无效
+  //单线程使用时游标pin住所在的叶子，value()直接引用缓存中的节点，不拷贝
+  //多线程访问时value()引用游标自己的叶子拷贝
+  Cursor find_one(const K& key) {
+    Cursor it = lower_bound(key);
+    if (it.valid() && compareKey(it.key(), key) == 0) return it;
+    return Cursor();
+  }
+
+  //把key的第一个value拷贝出来，返回是否找到
+  bool find_one(const K& key, T& value) {
+    Cursor it = find_one(key);
+    if (!it.valid()) return false;
+    value = it.value();
     return true;
   }
 
-  //清空整棵树
+  bool contains(const K& key) {
+    return find_one(key).valid();
+  }
+
+  //删除key和对应的value，removed不为空时存入树中被删除的那个value
+  bool erase(const K& key, const T& value, T* removed = nullptr) {
+    return eraseOne(KeyValue<T, K>(key, value), true, removed);
+  }
+
+  bool erase_without_merge(const K& key, const T& value, T* removed = nullptr) {
+    return eraseOne(KeyValue<T, K>(key, value), false, removed);
+  }
+
+  //清空整棵树并截断文件
   void clear() {
-    basic_info.total_num = 0;
-    basic_info.root = -1;
-    basic_info.write_offset = 3 * sizeof(int);
-    updateInfo();
+    std::unique_lock<RWLatch> guard = exclusiveGuard();
+    resetTree();
   }
 
   void print_tree() {
@@ -1117,57 +1805,327 @@ public:
       std::cout << "[Empty Tree]" << std::endl;
       return;
     }
-    print_node(basic_info.root, 0);
-    print_leaves(); 
+    print_node(basic_info.root, basic_info.root_is_leaf, 0);
+    print_leaves();
   }
 
-  void print_node(int node_offset, int depth) {
-    IndexNode<T, SIZE> node = readNode(node_offset);
-    
+  void print_node(int node_offset, bool leaf, int depth) {
     // 打印缩进和节点类型
     for (int i = 0; i < depth; ++i) std::cout << "│   ";
-    std::cout << (node.is_leaf ? "├─ Leaf " : "├─ Int  ");
-    std::cout << "[kv_num]: " << node.kv_num << ",";
-    
-    // 打印键值
-    std::cout << "[Offset:" << node.offset << "] keyvalues: ";
-    for (int i = 0; i < node.kv_num; ++i) {
-        std::cout << node.keyvalues[i];
-        if (i != node.kv_num - 1) std::cout << ", ";
+    if (leaf) {
+      LeafHandle node = pinLeaf(node_offset);
+      std::cout << "├─ Leaf " << "[kv_num]: " << node->kv_num << ",";
+      std::cout << "[Offset:" << node->offset << "] keyvalues: ";
+      for (int i = 0; i < node->kv_num; ++i) {
+        std::cout << node->keyvalues[i];
+        if (i != node->kv_num - 1) std::cout << ", ";
+      }
+      std::cout << std::endl;
+      return;
+    }
+    InnerHandle node = pinInner(node_offset);
+    std::cout << "├─ Int  " << "[kv_num]: " << node->kv_num << ",";
+    std::cout << "[Offset:" << node->offset << "] keys: ";
+    for (int i = 0; i < node->kv_num; ++i) {
+      std::cout << node->keys[i];
+      if (i != node->kv_num - 1) std::cout << ", ";
     }
     std::cout << std::endl;
 
-    // 递归打印子节点（非叶子节点）
-    if (!node.is_leaf && node.kv_num > 0) {
-      for (int i = 0; i <= node.kv_num; ++i) {
-        int coff = node.child_offset[i];
-        if (coff != -1) print_node(node.child_offset[i], depth + 1);
+    // 递归打印子节点
+    for (int i = 0; i <= node->kv_num; ++i) {
+      int coff = node->child_offset[i];
+      if (coff != -1) print_node(coff, node->leaf_children, depth + 1);
+    }
+  }
+
+  void print_leaves() {
+    std::cout << "\nLeaf Linked List: ";
+    if (basic_info.root == -1) return;
+    LeafHandle cur = firstLeaf();
+    while (cur.valid()) {
+      std::cout << "(";
+      for (int i = 0; i < cur->kv_num; ++i) {
+        std::cout << '[' << cur->keyvalues[i] << ']';
+        if (i != cur->kv_num - 1) std::cout << ",";
       }
+      std::cout << ") -> ";
+      if (cur->next != -1) cur = pinSibling(cur->next);
+      else cur.release();
     }
-}
+    std::cout << "END" << std::endl;
+  }
+
+  int get_num() {
+    std::lock_guard<std::mutex> lock(meta);
+    return basic_info.total_num;
+  }
+
+  //范围扫描越过叶子时最多往后预读k个叶子，0关闭预读
+  void set_read_ahead(int k) {
+    read_ahead = k;
+  }
+
+  //叶子和内部节点缓存的命中统计之和
+  PoolStats cache_stats() const {
+    PoolStats res = leaf_cache.stats();
+    res += inner_cache.stats();
+    return res;
+  }
+};
+
+/********************************************************************/
+//value堆模式
+/*
+叶子中存放的value引用：排序键加上记录在堆文件中的位置rid
+比较时只看排序键
+*/
+template<class T>
+struct HeapRef {
+  typename SortKey<T>::type sort_key;
+  int rid;
+
+  HeapRef() : sort_key(), rid(-1) {}
+  HeapRef(const T& value, int _rid) : sort_key(SortKey<T>::get(value)), rid(_rid) {}
 
-void print_leaves() {
-  std::cout << "\nLeaf Linked List: ";
-  if (basic_info.root == -1) return;
-  IndexNode<T, SIZE> cur = readNode(basic_info.root);
-  while (!cur.is_leaf) {
-    cur = readNode(cur.child_offset[0]);
+  bool operator<(const HeapRef& other) const {
+    return sort_key < other.sort_key;
+  }
+  bool operator>(const HeapRef& other) const {
+    return other.sort_key < sort_key;
+  }
+  bool operator<=(const HeapRef& other) const {
+    return !(other.sort_key < sort_key);
+  }
+  bool operator>=(const HeapRef& other) const {
+    return !(sort_key < other.sort_key);
+  }
+  bool operator==(const HeapRef& other) const {
+    return sort_key == other.sort_key;
+  }
+  bool operator!=(const HeapRef& other) const {
+    return !(sort_key == other.sort_key);
+  }
+  friend std::ostream& operator<<(std::ostream& os, const HeapRef& ref) {
+    os << "#" << ref.rid;
+    return os;
+  }
+};
+
+//堆模式的内部节点中分隔键只需要value的排序键，不需要rid
+template<class T>
+struct SortKey<HeapRef<T>> {
+  using type = typename SortKey<T>::type;
+  static const type& get(const HeapRef<T>& ref) {
+    return ref.sort_key;
   }
-  while (cur.offset != -1) {
-    std::cout << "(";
-    for (int i = 0; i < cur.kv_num; ++i) {
-      std::cout << '[' << cur.keyvalues[i] << ']';
-      if (i != cur.kv_num - 1) std::cout << ",";
+};
+
+/*
+value存放在独立堆文件中的B+树，接口与BPlusTree相同
+叶子只存key和HeapRef，扇出与T的大小无关，分裂和移位时不再拷贝整个value
+堆文件名为base_filename + "_heap"
+只能单线程使用，索引和堆文件都不支持BPlusTree::set_concurrent那样的多线程访问
+*/
+template<class T, int PAGE, int cache_size, int heap_cache_size = cache_size, bool unique_key = false, class K = Key,
+         template<class> class Policy = LRUPolicy>
+class HeapBPlusTree {
+private:
+  BPlusTree<HeapRef<T>, PAGE, cache_size, unique_key, K, Policy> index;
+  RecordHeap<T, heap_cache_size, Policy> heap;
+
+public:
+  /*
+  游标：遍历索引的叶子链表，value在访问时才从堆文件中取出并pin住
+  */
+  class Cursor {
+  private:
+    typename BPlusTree<HeapRef<T>, PAGE, cache_size, unique_key, K, Policy>::Cursor it;
+    RecordHeap<T, heap_cache_size, Policy>* heap = nullptr;
+    mutable typename RecordHeap<T, heap_cache_size, Policy>::Handle slot;
+
+  public:
+    Cursor() = default;
+    Cursor(typename BPlusTree<HeapRef<T>, PAGE, cache_size, unique_key, K, Policy>::Cursor _it, RecordHeap<T, heap_cache_size, Policy>* _heap) :
+    it(std::move(_it)), heap(_heap) {}
+
+    bool valid() const {
+      return it.valid();
+    }
+    const K& key() const {
+      return it.key();
+    }
+    const T& value() const {
+      if (!slot.valid()) slot = heap->pin(it.value().rid);
+      return slot->value;
+    }
+    void next() {
+      slot.release();
+      it.next();
     }
-    std::cout << ") -> ";
-    cur = (cur.next != -1) ? readNode(cur.next) : IndexNode<T, SIZE>();
+    void prev() {
+      slot.release();
+      it.prev();
+    }
+  };
+
+  Cursor lower_bound(const K& key) {
+    return Cursor(index.lower_bound(key), &heap);
   }
-  std::cout << "END" << std::endl;
-}
 
-int get_num() {
-  return basic_info.total_num;
-}
+  Cursor upper_bound(const K& key) {
+    return Cursor(index.upper_bound(key), &heap);
+  }
+
+  Cursor begin() {
+    return Cursor(index.begin(), &heap);
+  }
+
+  int count(const K& key) {
+    return index.count(key);
+  }
+
+  Cursor find_one(const K& key) {
+    return Cursor(index.find_one(key), &heap);
+  }
+
+  bool find_one(const K& key, T& value) {
+    Cursor it = find_one(key);
+    if (!it.valid()) return false;
+    value = it.value();
+    return true;
+  }
+
+  bool contains(const K& key) {
+    return index.contains(key);
+  }
+
+  HeapBPlusTree(string base_filename, WriteAheadLog* wal = nullptr) :
+  index(base_filename, wal), heap(base_filename + "_heap", wal) {}
+
+  void flush() {
+    index.flush();
+    heap.flush();
+  }
+
+  void start_writer(int pages_per_second) {
+    index.start_writer(pages_per_second);
+    heap.start_writer(pages_per_second);
+  }
+
+  void set_read_ahead(int k) {
+    index.set_read_ahead(k);
+  }
+
+  //先写堆文件取得rid再建索引，索引中已经存在时把刚分配的记录还回去
+  bool insert(const K& key, T& value) {
+    HeapRef<T> ref(value, heap.alloc(value));
+    if (index.insert(key, ref)) return true;
+    heap.free(ref.rid);
+    return false;
+  }
+
+  //value依次写进清空后的堆文件中，再用对应的HeapRef建索引，kvs没有排好序时返回false，树保持原样
+  //先清空索引，中途断电时索引是空的，不会指向还没有写好的记录
+  bool bulk_load(const sjtu::vector<KeyValue<T, K>>& kvs) {
+    sjtu::vector<int> keep;           //不重复的键值对在kvs中的下标
+    for (size_t i = 0; i < kvs.size(); ++i) {
+      if (i > 0) {
+        int res = KeyCompare<K>::compare(kvs[i].key, kvs[i - 1].key);
+        if (unique_key ? res < 0 : kvs[i] < kvs[i - 1]) return false;
+        if (unique_key ? res == 0 : kvs[i] == kvs[i - 1]) continue;
+      }
+      keep.push_back(i);
+    }
+    index.clear();
+    sjtu::vector<T> values;
+    for (size_t i = 0; i < keep.size(); ++i) values.push_back(kvs[keep[i]].value);
+    sjtu::vector<int> rids;
+    heap.load(values, rids);
+    sjtu::vector<KeyValue<HeapRef<T>, K>> refs;
+    for (size_t i = 0; i < keep.size(); ++i) {
+      refs.push_back(KeyValue<HeapRef<T>, K>(kvs[keep[i]].key, HeapRef<T>(kvs[keep[i]].value, rids[i])));
+    }
+    return index.bulk_load(refs);
+  }
+
+  bool find_pair(const K& key, const T& value) {
+    return index.find_pair(key, HeapRef<T>(value, -1));
+  }
+
+  //直接在堆文件中的记录上原地修改，叶子不需要改动
+  template<class Mutator>
+  bool update(const K& key, const T& value, Mutator mutator) {
+    HeapRef<T> ref;
+    if (!index.find_pair(key, HeapRef<T>(value, -1), &ref)) return false;
+    typename RecordHeap<T, heap_cache_size, Policy>::Handle slot = heap.pin(ref.rid);
+    mutator(slot->value);
+    slot.markDirty();
+    return true;
+  }
+
+  bool upsert(const K& key, T& value) {
+    HeapRef<T> ref;
+    if (index.find_pair(key, HeapRef<T>(value, -1), &ref)) {
+      heap.update(value, ref.rid);
+      return false;
+    }
+    insert(key, value);
+    return true;
+  }
+
+  sjtu::vector<T> find_all(const K& key) {
+    sjtu::vector<HeapRef<T>> refs = index.find_all(key);
+    sjtu::vector<T> ans;
+    T value;
+    //先把要读的记录都提示给内核，后面逐条读取时磁盘可以同时处理多个请求
+    if (refs.size() > 1) {
+      for (size_t i = 0; i < refs.size(); ++i) heap.prefetch(refs[i].rid);
+    }
+    for (size_t i = 0; i < refs.size(); ++i) {
+      heap.read(value, refs[i].rid);
+      ans.push_back(value);
+    }
+    return ans;
+  }
+
+  bool erase(const K& key, const T& value) {
+    HeapRef<T> removed;
+    if (!index.erase(key, HeapRef<T>(value, -1), &removed)) return false;
+    //树空了之后堆文件也一起截断
+    if (index.get_num() == 0) heap.clear();
+    else heap.free(removed.rid);
+    return true;
+  }
+
+  bool erase_without_merge(const K& key, const T& value) {
+    HeapRef<T> removed;
+    if (!index.erase_without_merge(key, HeapRef<T>(value, -1), &removed)) return false;
+    //树空了之后堆文件也一起截断
+    if (index.get_num() == 0) heap.clear();
+    else heap.free(removed.rid);
+    return true;
+  }
+
+  void clear() {
+    index.clear();
+    heap.clear();
+  }
+
+  void print_tree() {
+    index.print_tree();
+  }
+
+  int get_num() {
+    return index.get_num();
+  }
+
+  //索引和堆文件缓存的命中统计之和
+  PoolStats cache_stats() const {
+    PoolStats res = index.cache_stats();
+    res += heap.cache_stats();
+    return res;
+  }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,792 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+#include <new>
+#include <cstring>
+#include <atomic>
+#include <type_traits>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <sys/mman.h>
+#include "MemoryRiver.hpp"
+#include "vector.hpp"
+#include "ReplacePolicy.hpp"
+
+/*
+缓存的命中统计
+*/
+struct PoolStats {
+  long long hits = 0;
+  long long misses = 0;
+  long long evictions = 0;
+
+  double hit_rate() const {
+    return hits + misses == 0 ? 0 : (double)hits / (hits + misses);
+  }
+  PoolStats& operator+=(const PoolStats& other) {
+    hits += other.hits;
+    misses += other.misses;
+    evictions += other.evictions;
+    return *this;
+  }
+};
+
+/*
+页目录：位置索引到V的线性探测开放寻址哈希表，槽数是2的幂，至少是容量的两倍
+页的位置索引是页大小的整数倍，低位都是0，用乘法哈希取高位
+删除时把后面同一探测链上的元素往前移，不留墓碑
+全部页都被pin住时页数会暂时超过容量，装载因子超过1/2时槽数翻倍
+*/
+template<class V>
+class PageTable {
+private:
+  struct Slot {
+    int index = -1;                   //-1表示空槽
+    V value = V();
+  };
+  Slot* slots;
+  int bits;
+  int count = 0;
+
+  int home(int index) const {
+    return (int)(((unsigned int)index * 0x9E3779B1u) >> (32 - bits));
+  }
+
+  void grow() {
+    Slot* old = slots;
+    int old_size = 1 << bits;
+    ++bits;
+    slots = new Slot[1 << bits];
+    count = 0;
+    for (int i = 0; i < old_size; ++i) {
+      if (old[i].index != -1) insert(old[i].index, old[i].value);
+    }
+    delete[] old;
+  }
+
+public:
+  explicit PageTable(int capacity) : bits(4) {
+    while ((1 << bits) < 2 * capacity) ++bits;
+    slots = new Slot[1 << bits];
+  }
+  PageTable(const PageTable&) = delete;
+  PageTable& operator=(const PageTable&) = delete;
+  ~PageTable() {
+    delete[] slots;
+  }
+
+  //找不到时返回V()
+  V find(int index) const {
+    int mask = (1 << bits) - 1;
+    for (int i = home(index); slots[i].index != -1; i = (i + 1) & mask) {
+      if (slots[i].index == index) return slots[i].value;
+    }
+    return V();
+  }
+
+  //index不能已经在表中
+  void insert(int index, V value) {
+    if (2 * (count + 1) > (1 << bits)) grow();
+    int mask = (1 << bits) - 1;
+    int i = home(index);
+    while (slots[i].index != -1) i = (i + 1) & mask;
+    slots[i].index = index;
+    slots[i].value = value;
+    ++count;
+  }
+
+  void erase(int index) {
+    int mask = (1 << bits) - 1;
+    int i = home(index);
+    while (slots[i].index != index) {
+      if (slots[i].index == -1) return;
+      i = (i + 1) & mask;
+    }
+    //往后找能填进空槽i的元素：它的起始槽不在(i, j]之间
+    for (int j = (i + 1) & mask; slots[j].index != -1; j = (j + 1) & mask) {
+      int h = home(slots[j].index);
+      if (((j - h) & mask) >= ((j - i) & mask)) {
+        slots[i] = slots[j];
+        i = j;
+      }
+    }
+    slots[i].index = -1;
+    slots[i].value = V();
+    --count;
+  }
+
+  template<class F>
+  void for_each(F f) const {
+    int n = 1 << bits;
+    for (int i = 0; i < n; ++i) {
+      if (slots[i].index != -1) f(slots[i].value);
+    }
+  }
+
+  void clear() {
+    int n = 1 << bits;
+    for (int i = 0; i < n; ++i) {
+      slots[i].index = -1;
+      slots[i].value = V();
+    }
+    count = 0;
+  }
+
+  int size() const {
+    return count;
+  }
+};
+
+/*
+读写锁：共享者之间不互斥，独占者与所有人互斥
+有独占者在排队时新来的共享者先等它，源源不断的共享者不会让独占者一直等下去
+已经持有共享锁的线程再加共享锁时不排队，否则它等排队的独占者，独占者又等它放开手里的锁；
+独占者持有锁期间不会再等别的锁，所以不会循环等待
+
+另带一个版本号，可以当作顺序锁乐观地读：独占期间版本号是奇数，每次独占加2
+读者用optimistic()取得版本号后不加锁直接读，读完用validate()检查期间没有独占者，否则丢掉读到的内容重读
+*/
+class RWLatch {
+private:
+  std::mutex m;
+  std::condition_variable cv;
+  int readers = 0;
+  int waiting = 0;                    //排队的独占者
+  bool writer = false;
+  std::atomic<unsigned> seq{0};       //版本号
+
+  //当前线程持有的共享锁个数，不分是哪个RWLatch
+  static int& heldByThread() {
+    static thread_local int held = 0;
+    return held;
+  }
+
+public:
+  void lock_shared() {
+    int& held = heldByThread();
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [this, &held]() { return !writer && (held > 0 || waiting == 0); });
+    ++readers;
+    ++held;
+  }
+  void unlock_shared() {
+    --heldByThread();
+    std::lock_guard<std::mutex> lock(m);
+    if (--readers == 0) cv.notify_all();
+  }
+  void lock() {
+    std::unique_lock<std::mutex> lock(m);
+    ++waiting;
+    cv.wait(lock, [this]() { return !writer && readers == 0; });
+    --waiting;
+    writer = true;
+    seq.fetch_add(1);
+  }
+  void unlock() {
+    seq.fetch_add(1, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(m);
+    writer = false;
+    cv.notify_all();
+  }
+
+  //当前的版本号，奇数表示正被独占
+  unsigned version() const {
+    return seq.load();
+  }
+  //等到没有独占者
+  void wait_unlocked() {
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [this]() { return !writer; });
+  }
+  //等到没有独占者时返回版本号，之后读到的内容要用validate检查
+  unsigned optimistic() {
+    for (;;) {
+      unsigned v = seq.load(std::memory_order_acquire);
+      if (!(v & 1)) return v;
+      wait_unlocked();
+    }
+  }
+  //取得版本号v之后读到的内容是否一致
+  bool validate(unsigned v) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return seq.load(std::memory_order_relaxed) == v;
+  }
+};
+
+/*
+乐观读者的登记：每个线程固定用一个计数器，计数器各占一个缓存行，登记时不和别的线程抢同一行
+要丢弃缓存中的页时，先让对应的RWLatch的版本号变成奇数，再等所有计数器归零；
+读者先登记再看版本号，是奇数就退出登记等它变回偶数，两边都用顺序一致的原子操作，
+所以要么读者看到奇数，要么丢弃的一方等到读者离开，登记期间pin住的页不会被丢弃
+*/
+class ReaderSlots {
+private:
+  static constexpr int slot_count = 64;
+  struct alignas(64) Slot {
+    std::atomic<int> readers{0};
+  };
+  Slot slots[slot_count];
+
+  static int mine() {
+    static std::atomic<int> next{0};
+    static thread_local int index = next.fetch_add(1) % slot_count;
+    return index;
+  }
+
+public:
+  //登记之后等到latch没有独占者，返回登记时的版本号
+  unsigned enter(RWLatch& latch) {
+    Slot& slot = slots[mine()];
+    for (;;) {
+      slot.readers.fetch_add(1);
+      unsigned v = latch.version();
+      if (!(v & 1)) return v;
+      slot.readers.fetch_sub(1);
+      latch.wait_unlocked();
+    }
+  }
+  void leave() {
+    slots[mine()].readers.fetch_sub(1, std::memory_order_release);
+  }
+  //等所有登记的读者离开，调用者已经独占了读者enter时用的RWLatch
+  void wait_empty() {
+    for (int i = 0; i < slot_count; ++i) {
+      while (slots[i].readers.load() != 0) std::this_thread::yield();
+    }
+  }
+};
+
+enum class LatchMode { None, Shared, Exclusive };
+
+/*
+页缓存：把文件中位置索引为index的定长页缓存在内存中，换出策略由Policy决定（见ReplacePolicy.hpp）
+通过Handle访问页，Handle存活期间页被pin住，不会被换出
+capacity个frame在第一次未命中时一次性分配在一块连续的匿名映射中，换出后放回空闲链表复用
+接入写前日志后，页在一次提交中第一次被修改时多pin一次，直到提交写进日志并且落盘才放开，日志没有落盘的修改不会写回文件
+arena中的每个frame另有一份影子页保存最后一次提交的内容，提交时只把和它相比变化了的部分写进日志
+
+可以用start_writer()开启后台写回线程，按位置顺序把没有被pin住的脏页慢慢写回，让换出时尽量不用同步写盘
+开启后页目录和换出策略由latch保护；页的内容只有持有Handle的线程会修改，写回线程先pin住页，
+在latch下把页拷贝出来再写，写的过程中页又被修改过(version变了)就保持脏的状态
+
+set_shared(true)之后多个线程可以同时使用缓存：页目录、换出策略和提交列表都加锁，
+页内容的互斥由使用者通过Handle::latch()给页加读写锁负责，读者也可以用Handle::optimistic()不加锁地读
+*/
+template<class Page, int info_len, int capacity, template<class> class Policy = LRUPolicy>
+class BufferPool : public WalParticipant {
+  //页按字节在缓存、影子页和文件之间拷贝
+  static_assert(std::is_trivially_copyable<Page>::value, "Page must be trivially copyable");
+
+private:
+  struct Frame {
+    Page page;
+    int index = -1;                   //页在文件中的位置索引
+    //dirty和version由持有Handle的线程不加latch地修改，写回线程在latch下读，所以都是原子变量
+    std::atomic<bool> dirty{false};
+    std::atomic<int> pin_count{0};    //被Handle引用的次数，大于0时不会被换出
+    std::atomic<int> version{0};      //每次markDirty加一，写回线程用来判断写的是不是最新的内容
+    BufferPool* pool = nullptr;       //接入了写前日志时指向所在的缓存
+    bool unsynced = false;            //有还没有随日志落盘的修改
+    bool changed = false;             //在这次提交中修改过，还没有写进日志
+    bool shadowed = false;            //影子页中是这一页最后一次提交的内容
+    Frame* prev = nullptr;            //以下字段由换出策略使用
+    Frame* next = nullptr;
+    bool ref = false;
+    int queue = 0;
+    RWLatch rw;                       //页内容的读写锁，只在多线程访问时使用
+  };
+
+public:
+  /*
+  页句柄：直接指向缓存中的页，通过句柄原地修改后需要调用markDirty()
+  */
+  class Handle {
+  private:
+    Page* page = nullptr;
+    Frame* frame = nullptr;
+    LatchMode held = LatchMode::None;  //拷贝出的Handle不持有锁
+  public:
+    Handle() = default;
+    explicit Handle(Frame* _frame) : page(&_frame->page), frame(_frame) {
+      ++frame->pin_count;
+    }
+    Handle(const Handle& other) : page(other.page), frame(other.frame) {
+      if (frame) ++frame->pin_count;
+    }
+    Handle(Handle&& other) noexcept : page(other.page), frame(other.frame), held(other.held) {
+      other.page = nullptr;
+      other.frame = nullptr;
+      other.held = LatchMode::None;
+    }
+    Handle& operator=(Handle other) noexcept {
+      Page* tmp_page = page;
+      Frame* tmp_frame = frame;
+      LatchMode tmp_held = held;
+      page = other.page;
+      frame = other.frame;
+      held = other.held;
+      other.page = tmp_page;
+      other.frame = tmp_frame;
+      other.held = tmp_held;
+      return *this;
+    }
+    ~Handle() {
+      release();
+    }
+
+    //提前unpin，持有的锁先放开
+    void release() {
+      if (held == LatchMode::Shared) frame->rw.unlock_shared();
+      if (held == LatchMode::Exclusive) frame->rw.unlock();
+      if (frame) --frame->pin_count;
+      page = nullptr;
+      frame = nullptr;
+      held = LatchMode::None;
+    }
+    //给页加读锁或写锁，Handle释放时放开
+    void latch(LatchMode mode) {
+      if (!frame || held != LatchMode::None) return;
+      if (mode == LatchMode::Shared) frame->rw.lock_shared();
+      if (mode == LatchMode::Exclusive) frame->rw.lock();
+      held = mode;
+    }
+    //乐观地读页：不加锁，读之前取得页的版本号，读完检查期间没有人给页加写锁
+    unsigned optimistic() const {
+      return frame ? frame->rw.optimistic() : 0;
+    }
+    bool validate(unsigned v) const {
+      return !frame || frame->rw.validate(v);
+    }
+    void markDirty() const {
+      if (frame) touch(frame);
+    }
+    bool valid() const {
+      return page != nullptr;
+    }
+    Page* operator->() const {
+      return page;
+    }
+    Page& operator*() const {
+      return *page;
+    }
+  };
+
+private:
+  //标记frame被修改，接入日志时在提交的日志落盘前一直pin住
+  static void touch(Frame* f) {
+    ++f->version;
+    f->dirty = true;
+    if (f->pool && !f->changed) f->pool->addPending(f);
+  }
+
+  //一批提交中多次修改的页只pin一次，但每次提交都要重新比较
+  void addPending(Frame* f) {
+    std::unique_lock<std::mutex> lock = shared ? std::unique_lock<std::mutex>(pending_latch) : std::unique_lock<std::mutex>();
+    f->changed = true;
+    pending.push_back(f);
+    if (f->unsynced) return;
+    f->unsynced = true;
+    ++f->pin_count;
+    held.push_back(f);
+  }
+
+  MemoryRiver<Page, info_len>& file;
+  WriteAheadLog* wal = nullptr;
+  sjtu::vector<Frame*> pending;       //这次提交中修改过的页
+  sjtu::vector<Frame*> held;          //日志还没有落盘的提交中修改过的页
+  PageTable<Frame*> table;
+  Policy<Frame> policy;
+  PoolStats stat;
+  Frame* arena = nullptr;             //capacity个frame
+  Frame* free_list = nullptr;         //空闲的frame用next串起来
+  Page* shadows = nullptr;            //接入日志时和arena一起分配，与arena中的frame一一对应
+  bool arena_tried = false;           //已经分配过arena，失败了也不再重试
+  bool arena_mapped = false;          //arena和影子页是匿名映射还是operator new分配的
+  bool shadows_mapped = false;
+
+  /*后台写回相关*/
+  std::mutex latch;                   //开启写回线程后保护页目录、换出策略和frame的分配
+  std::mutex io;                      //写回线程的一轮写回与flush、drop互斥
+  std::mutex pending_latch;           //多线程访问时保护pending和held
+  bool shared = false;                //多线程访问
+  std::condition_variable wake;
+  std::thread writer;
+  bool background = false;
+  bool stopping = false;
+  int flush_rate = 0;                 //每秒最多写回的页数
+  int sweep = -1;                     //上一轮写到的位置，下一轮从它后面接着写
+  static constexpr int tick_ms = 10;
+
+  //没开写回线程也不是多线程访问时不加锁
+  std::unique_lock<std::mutex> lockLatch() {
+    return background || shared ? std::unique_lock<std::mutex>(latch) : std::unique_lock<std::mutex>();
+  }
+  std::unique_lock<std::mutex> lockIO() {
+    return background ? std::unique_lock<std::mutex>(io) : std::unique_lock<std::mutex>();
+  }
+
+  //按位置排序的修改已经随日志落盘的脏页，后台写回时还要跳过被pin住的页
+  sjtu::vector<Frame*> dirtyFrames(bool skip_pinned) {
+    sjtu::vector<Frame*> dirty;
+    table.for_each([&dirty, skip_pinned](Frame* f) {
+      if (skip_pinned && f->pin_count > 0) return;
+      if (f->dirty && !f->unsynced) dirty.push_back(f);
+    });
+    for (int i = 1; i < (int)dirty.size(); ++i) {
+      Frame* cur = dirty[i];
+      int j = i;
+      for (; j > 0 && dirty[j - 1]->index > cur->index; --j) dirty[j] = dirty[j - 1];
+      dirty[j] = cur;
+    }
+    return dirty;
+  }
+
+  //写回index处的页：pin住并拷贝出来，放开latch写盘，写完后页没有再被修改才标记为干净
+  void writeBack(int index, Page* scratch) {
+    std::unique_lock<std::mutex> lock(latch);
+    Frame* f = table.find(index);
+    //被pin住的页可能正在被修改，先看pin_count再看其他字段
+    //所在提交的日志还没有落盘的页不能写回，否则断电后数据文件会比日志新
+    if (!f || f->pin_count > 0 || !f->dirty || f->unsynced) return;
+    ++f->pin_count;
+    int version = f->version;
+    std::memcpy(static_cast<void*>(scratch), static_cast<const void*>(&f->page), sizeof(Page));
+    lock.unlock();
+    file.writeT(*scratch, index);
+    lock.lock();
+    if (f->pin_count == 1 && f->version == version) f->dirty = false;
+    --f->pin_count;
+  }
+
+  //每tick_ms毫秒接着上一轮的位置往后写回一批脏页，写到文件末尾后从头开始
+  //只在可以写回的脏页超过容量的一半时才写，保证换出时有干净的页可用，又不反复写回经常修改的页
+  void writerLoop() {
+    Page* scratch = static_cast<Page*>(::operator new(sizeof(Page)));
+    int budget = flush_rate * tick_ms / 1000 > 0 ? flush_rate * tick_ms / 1000 : 1;
+    std::unique_lock<std::mutex> lock(io);
+    while (!stopping) {
+      //只记下位置，真正写的时候frame可能已经被换出
+      sjtu::vector<int> dirty;
+      {
+        std::lock_guard<std::mutex> guard(latch);
+        sjtu::vector<Frame*> frames = dirtyFrames(true);
+        for (int i = 0; i < (int)frames.size(); ++i) dirty.push_back(frames[i]->index);
+      }
+      int n = dirty.size();
+      int excess = n - capacity / 2;
+      int start = 0;
+      while (start < n && dirty[start] <= sweep) ++start;
+      if (start == n) start = 0;
+      for (int i = 0; i < excess && i < budget; ++i) {
+        sweep = dirty[(start + i) % n];
+        writeBack(sweep, scratch);
+      }
+      wake.wait_for(lock, std::chrono::milliseconds(tick_ms));
+    }
+    ::operator delete(scratch);
+  }
+
+  static constexpr size_t arena_len = capacity * sizeof(Frame);
+  static constexpr size_t shadow_len = capacity * sizeof(Page);
+
+  //优先用匿名映射分配len字节，失败时退回operator new，都失败时返回nullptr
+  static void* allocBlock(size_t len, bool& mapped) {
+    void* mem = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    mapped = mem != MAP_FAILED;
+    if (mapped) return mem;
+    return ::operator new(len, std::nothrow);
+  }
+
+  static void freeBlock(void* mem, size_t len, bool mapped) {
+    if (mapped) ::munmap(mem, len);
+    else ::operator delete(mem);
+  }
+
+  //分配frame池，足够大时建议内核用大页，只在第一次未命中时调用一次
+  //分配失败后不再重试，之后每次未命中都临时new一个frame
+  void allocArena() {
+    arena_tried = true;
+    void* mem = allocBlock(arena_len, arena_mapped);
+    if (!mem) return;
+#ifdef MADV_HUGEPAGE
+    if (arena_mapped && arena_len >= (2u << 20)) ::madvise(mem, arena_len, MADV_HUGEPAGE);
+#endif
+    arena = static_cast<Frame*>(mem);
+    for (int i = capacity - 1; i >= 0; --i) {
+      Frame* f = new (arena + i) Frame;
+      f->next = free_list;
+      free_list = f;
+    }
+    //没有影子页时每一页都要整页写进日志
+    if (wal) shadows = static_cast<Page*>(allocBlock(shadow_len, shadows_mapped));
+  }
+
+  void freeArena() {
+    if (!arena) return;
+    for (int i = 0; i < capacity; ++i) arena[i].~Frame();
+    freeBlock(arena, arena_len, arena_mapped);
+    if (shadows) freeBlock(shadows, shadow_len, shadows_mapped);
+    arena = nullptr;
+    free_list = nullptr;
+    shadows = nullptr;
+  }
+
+  bool inArena(const Frame* f) const {
+    return arena && f >= arena && f < arena + capacity;
+  }
+
+  //临时new出来的frame没有影子页
+  Page* shadowOf(const Frame* f) const {
+    return shadows && inArena(f) ? shadows + (f - arena) : nullptr;
+  }
+
+  //按64字节一块和影子页比较，把变化的部分写进日志并更新影子页，相邻的变化合并成一条记录
+  void logDiff(WriteAheadLog& log, int index, Page& base, const Page& page) {
+    const char* cur = reinterpret_cast<const char*>(&page);
+    char* old = reinterpret_cast<char*>(&base);
+    const int len = sizeof(Page), block = 64;
+    int begin = -1, end = -1;
+    auto emit = [&]() {
+      log.logPage(file.file_name, index + begin, cur + begin, end - begin);
+      std::memcpy(old + begin, cur + begin, end - begin);
+    };
+    for (int pos = 0; pos < len; pos += block) {
+      int n = len - pos < block ? len - pos : block;
+      if (std::memcmp(cur + pos, old + pos, n) == 0) continue;
+      if (begin != -1 && pos > end + block) {
+        emit();
+        begin = -1;
+      }
+      if (begin == -1) begin = pos;
+      end = pos + n;
+    }
+    if (begin != -1) emit();
+  }
+
+  //取一个空闲的frame，frame全部被pin住而超出容量时才临时new一个
+  Frame* takeFrame() {
+    if (!arena_tried) allocArena();
+    if (!free_list) return new Frame;
+    Frame* f = free_list;
+    free_list = f->next;
+    return f;
+  }
+
+  void releaseFrame(Frame* f) {
+    if (!inArena(f)) {
+      delete f;
+      return;
+    }
+    f->index = -1;
+    f->dirty = false;
+    f->pin_count = 0;
+    f->version = 0;
+    f->unsynced = false;
+    f->changed = false;
+    f->shadowed = false;
+    f->prev = nullptr;
+    f->ref = false;
+    f->queue = 0;
+    f->next = free_list;
+    free_list = f;
+  }
+
+  //按策略换出一页，全部被pin住时暂时允许超出容量
+  void evict() {
+    Frame* old = policy.victim();
+    if (!old) return;
+    //所在提交的日志还没有落盘的页不能写回，放回策略中，这次暂时超出容量
+    if (old->unsynced) {
+      policy.admit(old);
+      return;
+    }
+    if (old->dirty) {
+      file.writeT(old->page, old->index);
+      old->dirty = false;
+    }
+    table.erase(old->index);
+    ++stat.evictions;
+    releaseFrame(old);
+  }
+
+  Frame* newFrame(int index) {
+    if (table.size() >= capacity) evict();
+    Frame* f = takeFrame();
+    f->index = index;
+    f->pool = wal ? this : nullptr;
+    f->next = nullptr;
+    table.insert(index, f);
+    policy.admit(f);
+    return f;
+  }
+
+public:
+  explicit BufferPool(MemoryRiver<Page, info_len>& _file) : file(_file), table(capacity), policy(capacity) {}
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  ~BufferPool() {
+    stop_writer();
+    if (wal) wal->detach(this);
+    flush();
+    drop();
+    freeArena();
+  }
+
+  //pin住index位置的页，未命中时直接读进新的frame
+  Handle pin(int index) {
+    std::unique_lock<std::mutex> lock = lockLatch();
+    Frame* hit = table.find(index);
+    if (hit) {
+      ++stat.hits;
+      policy.access(hit);
+      return Handle(hit);
+    }
+    ++stat.misses;
+    Frame* f = newFrame(index);
+    file.read(f->page, index);
+    if (Page* base = shadowOf(f)) {
+      std::memcpy(static_cast<void*>(base), static_cast<const void*>(&f->page), sizeof(Page));
+      f->shadowed = true;
+    }
+    return Handle(f);
+  }
+
+  //index处的页是否在缓存中
+  bool cached(int index) {
+    std::unique_lock<std::mutex> lock = lockLatch();
+    return table.find(index) != nullptr;
+  }
+
+  //不pin住也不算作访问地看一眼缓存中的页：在latch下对页调用read，没有缓存时返回false
+  template<class F>
+  bool peek(int index, F read) {
+    std::unique_lock<std::mutex> lock = lockLatch();
+    Frame* f = table.find(index);
+    if (!f) return false;
+    read(static_cast<const Page&>(f->page));
+    return true;
+  }
+
+  //提示内核预读index处的页，已经缓存的页不用读
+  void prefetch(int index) {
+    if (!cached(index)) file.prefetch(index);
+  }
+
+  //为即将写入新内容的页取得句柄，不读文件，页的内容由调用者初始化
+  Handle create(int index) {
+    std::unique_lock<std::mutex> lock = lockLatch();
+    Frame* f = table.find(index);
+    if (f) {
+      policy.access(f);
+    } else {
+      f = newFrame(index);
+    }
+    touch(f);
+    return Handle(f);
+  }
+
+  //接入写前日志
+  void attach(WriteAheadLog* _wal) {
+    wal = _wal;
+    wal->attach(this);
+  }
+
+  bool logged() const {
+    return wal != nullptr;
+  }
+
+  //允许多个线程同时使用缓存，只能在没有其他线程使用时切换
+  void set_shared(bool on) {
+    shared = on;
+  }
+
+  //开启后台写回线程，每秒最多写回pages_per_second页
+  void start_writer(int pages_per_second) {
+    if (background || pages_per_second <= 0) return;
+    flush_rate = pages_per_second;
+    background = true;
+    stopping = false;
+    writer = std::thread([this]() { writerLoop(); });
+  }
+
+  void stop_writer() {
+    if (!background) return;
+    {
+      std::lock_guard<std::mutex> guard(io);
+      stopping = true;
+    }
+    wake.notify_all();
+    writer.join();
+    background = false;
+  }
+
+  void logChanges(WriteAheadLog& log) override {
+    for (int i = 0; i < (int)pending.size(); ++i) {
+      Frame* f = pending[i];
+      f->changed = false;
+      Page* base = shadowOf(f);
+      if (base && f->shadowed) {
+        logDiff(log, f->index, *base, f->page);
+        continue;
+      }
+      //新建的页没有可以比较的内容，整页写进日志
+      log.logPage(file.file_name, f->index, &f->page, sizeof(Page));
+      if (base) {
+        std::memcpy(static_cast<void*>(base), static_cast<const void*>(&f->page), sizeof(Page));
+        f->shadowed = true;
+      }
+    }
+    if (pending.size() > 0) pending.clear();
+  }
+
+  void afterCommit() override {
+    if (held.size() == 0) return;
+    for (int i = 0; i < (int)held.size(); ++i) {
+      held[i]->unsynced = false;
+      --held[i]->pin_count;
+    }
+    held.clear();
+  }
+
+  bool checkpoint() override {
+    flush();
+    return file.flush();
+  }
+
+  //把脏页按在文件中的顺序全部写回，还没有提交的页除外
+  void flush() {
+    std::unique_lock<std::mutex> io_lock = lockIO();
+    std::unique_lock<std::mutex> lock = lockLatch();
+    sjtu::vector<Frame*> dirty = dirtyFrames(false);
+    for (int i = 0; i < (int)dirty.size(); ++i) {
+      file.writeT(dirty[i]->page, dirty[i]->index);
+      dirty[i]->dirty = false;
+    }
+  }
+
+  //丢弃全部缓存的页，不写回
+  void drop() {
+    std::unique_lock<std::mutex> io_lock = lockIO();
+    std::unique_lock<std::mutex> lock = lockLatch();
+    table.for_each([this](Frame* f) {
+      releaseFrame(f);
+    });
+    table.clear();
+    policy.clear();
+    if (pending.size() > 0) pending.clear();
+    if (held.size() > 0) held.clear();
+  }
+
+  int size() const {
+    return table.size();
+  }
+
+  const PoolStats& stats() const {
+    return stat;
+  }
+};
+
+#endif
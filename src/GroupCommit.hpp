@@ -0,0 +1,102 @@
+#ifndef GROUP_COMMIT_HPP
+#define GROUP_COMMIT_HPP
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <poll.h>
+#include "WriteAheadLog.hpp"
+
+//None: 日志只写进内核缓冲，不落盘，修改随即写回数据文件，进程崩溃不丢数据，断电可能损坏数据
+//Batched: 攒够一批命令或者等待超过一定时间后一起落盘
+//PerCommand: 每条修改了数据的命令都单独落盘
+enum class Durability { None, Batched, PerCommand };
+
+//从环境变量TICKET_DURABILITY读取持久化级别：none、batched或command，默认batched
+inline Durability durabilityFromEnv() {
+  const char* level = std::getenv("TICKET_DURABILITY");
+  if (!level) return Durability::Batched;
+  if (std::strcmp(level, "none") == 0) return Durability::None;
+  if (std::strcmp(level, "command") == 0) return Durability::PerCommand;
+  return Durability::Batched;
+}
+
+/*
+组提交：每条命令执行完后调用commit()把修改写进日志，按持久化级别决定何时让日志落盘
+None以外的级别下修改和命令的输出都先压着，所在的一批提交落盘之后修改才写回数据文件，输出才真正放出，
+这样看到输出的客户端可以确信对应的修改不会因为断电而丢失
+Batched模式下攒够batch_size条命令、距离上次落盘超过batch_us微秒，或者输入暂时没有更多命令时落盘，
+最后一种情况保证交互使用时输出不会一直被压着
+*/
+class GroupCommit {
+private:
+  WriteAheadLog& wal;
+  Durability level;
+  int batch_size;
+  long long batch_us;
+  std::ostream& out;
+  std::streambuf* target = nullptr;   //真正的输出，None模式下不替换
+  std::stringbuf pending;             //还没有落盘的命令的输出
+  int commands = 0;                   //这一批中的命令数
+  std::chrono::steady_clock::time_point batch_start;
+
+  //标准输入中暂时没有下一条命令，再读就要阻塞
+  static bool inputIdle() {
+    if (std::cin.rdbuf()->in_avail() > 0) return false;
+    pollfd pfd{0, POLLIN, 0};
+    return ::poll(&pfd, 1, 0) == 0;
+  }
+
+  void release() {
+    if (!target) return;
+    std::string text = pending.str();
+    if (!text.empty()) {
+      target->sputn(text.data(), text.size());
+      pending.str("");
+    }
+    target->pubsync();
+  }
+
+public:
+  GroupCommit(WriteAheadLog& _wal, std::ostream& _out, Durability _level,
+              int _batch_size = 64, long long _batch_us = 2000) :
+  wal(_wal), level(_level), batch_size(_batch_size), batch_us(_batch_us), out(_out),
+  batch_start(std::chrono::steady_clock::now()) {
+    if (level != Durability::None) target = out.rdbuf(&pending);
+  }
+
+  GroupCommit(const GroupCommit&) = delete;
+  GroupCommit& operator=(const GroupCommit&) = delete;
+
+  ~GroupCommit() {
+    sync();
+    if (target) out.rdbuf(target);
+  }
+
+  //提交一条命令的修改，需要时让这一批落盘并放出输出
+  void commit() {
+    wal.commit();
+    if (level == Durability::None) {
+      wal.apply();
+      return;
+    }
+    if (level == Durability::Batched) {
+      ++commands;
+      long long waited = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - batch_start).count();
+      if (commands < batch_size && waited < batch_us && !inputIdle()) return;
+    }
+    sync();
+  }
+
+  //让已经提交的修改全部落盘，然后放出暂存的输出
+  void sync() {
+    wal.sync();
+    commands = 0;
+    batch_start = std::chrono::steady_clock::now();
+    release();
+  }
+};
+
+#endif
@@ -1,104 +1,283 @@
 #ifndef BPT_MEMORYRIVER_HPP
 #define BPT_MEMORYRIVER_HPP
 
-#include <fstream>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "WriteAheadLog.hpp"
 
 using std::string;
-using std::fstream;
-using std::ifstream;
-using std::ofstream;
 
+//文件在MemoryRiver的整个生命周期内只打开一次，所有读写都用pread/pwrite在给定偏移处完成
+//接入写前日志后，文件头的修改和清空都先暂存，提交时写进日志，日志落盘之后才真正写入文件
 template<class T, int info_len = 2>
-class MemoryRiver {
+class MemoryRiver : public WalParticipant {
 private:
-    fstream file;
+    int fd = -1;
     int sizeofT = sizeof(T);
+
+    /*写前日志相关*/
+    WriteAheadLog *wal = nullptr;
+    int info_buf[info_len];           //还没有写入文件的文件头
+    bool info_staged = false;
+    bool info_changed = false;        //文件头在这次提交中改过，还没有写进日志
+    bool truncate_staged = false;
+    bool write_failed = false;        //上次flush()之后有pwrite没有写完
+
+    //把当前的文件头读进info_buf准备修改
+    void stage_info() {
+        if (info_staged) return;
+        for (int i = 0; i < info_len; ++i) info_buf[i] = 0;
+        if (!truncate_staged) pread_all(info_buf, sizeof(info_buf), 0);
+        info_staged = true;
+    }
+
+    void ensure_open() {
+        if (fd == -1) fd = ::open(file_name.c_str(), O_RDWR | O_CREAT, 0644);
+    }
+
+    //pread/pwrite可能只完成一部分，循环直到读写完毕
+    void pread_all(void *buf, size_t len, off_t pos) {
+        ensure_open();
+        char *p = reinterpret_cast<char *>(buf);
+        while (len > 0) {
+            ssize_t n = ::pread(fd, p, len, pos);
+            if (n <= 0) return;
+            p += n;
+            pos += n;
+            len -= n;
+        }
+    }
+
+    void pwrite_all(const void *buf, size_t len, off_t pos) {
+        ensure_open();
+        const char *p = reinterpret_cast<const char *>(buf);
+        while (len > 0) {
+            ssize_t n = ::pwrite(fd, p, len, pos);
+            if (n <= 0) {
+                write_failed = true;
+                return;
+            }
+            p += n;
+            pos += n;
+            len -= n;
+        }
+    }
+
 public:
     string file_name;
     MemoryRiver() = default;
 
     MemoryRiver(const string& file_name) : file_name(file_name) {}
 
-    fstream get_file() {
-        return file;
+    MemoryRiver(const MemoryRiver &) = delete;
+    MemoryRiver &operator=(const MemoryRiver &) = delete;
+
+    ~MemoryRiver() {
+        if (wal) wal->detach(this);
+        close();
+    }
+
+    //接入写前日志
+    void attach(WriteAheadLog *_wal) {
+        wal = _wal;
+        wal->attach(this);
+    }
+
+    void logChanges(WriteAheadLog &log) override {
+        //截断记录在clear()时已经写进日志
+        //日志落盘前文件头一直暂存着，只在改过的提交中记录
+        if (info_changed) log.logPage(file_name, 0, info_buf, sizeof(info_buf));
+        info_changed = false;
+    }
+
+    void afterCommit() override {
+        //日志已经落盘，截断或文件头写失败时数据文件和日志不一致，直接终止，重启后重放日志
+        if (truncate_staged) {
+            ensure_open();
+            if (::ftruncate(fd, 0) != 0) WriteAheadLog::fail("truncate");
+            truncate_staged = false;
+        }
+        if (info_staged) {
+            pwrite_all(info_buf, sizeof(info_buf), 0);
+            if (write_failed) WriteAheadLog::fail("write info");
+            info_staged = false;
+        }
+    }
+
+    bool checkpoint() override {
+        return flush();
+    }
+
+    int get_fd() {
+        ensure_open();
+        return fd;
+    }
+
+    //打开文件并一直保持到close()，返回文件原先是否存在
+    bool open() {
+        if (fd != -1) return true;
+        fd = ::open(file_name.c_str(), O_RDWR);
+        bool existed = fd != -1;
+        if (!existed) fd = ::open(file_name.c_str(), O_RDWR | O_CREAT, 0644);
+        return existed;
+    }
+
+    //把内核缓冲中的数据落盘
+    //返回上次flush()以来的写入是否全部落盘
+    bool flush() {
+        bool ok = !write_failed;
+        write_failed = false;
+        if (fd != -1 && ::fdatasync(fd) != 0) ok = false;
+        return ok;
+    }
+
+    void close() {
+        info_staged = false;
+        info_changed = false;
+        truncate_staged = false;
+        if (fd != -1) ::close(fd);
+        fd = -1;
     }
 
     void initialise(string FN = "") {
-        if (FN != "") file_name = FN;
-        file.open(file_name, std::ios::out);
-        int tmp = 0;
-        for (int i = 0; i < info_len; ++i) {
-            file.write(reinterpret_cast<char *>(&tmp), sizeof(int));
+        if (FN != "") {
+            close();
+            file_name = FN;
         }
-        file.close();
+        ensure_open();
+        ::ftruncate(fd, 0);
+        int tmp[info_len] = {0};
+        pwrite_all(tmp, sizeof(tmp), 0);
     }
     //清空文件
     void clear() {
-        ofstream file(file_name, std::ios::trunc);
-        file.close();
+        if (wal) {
+            wal->logTruncate(file_name);
+            truncate_staged = true;
+            info_staged = false;
+            info_changed = false;
+            return;
+        }
+        ensure_open();
+        ::ftruncate(fd, 0);
+    }
+
+    /*
+    以下三个函数不经过日志直接修改文件并落盘，失败时终止进程
+    接入日志时只能在WriteAheadLog::drain()之后使用，此时日志中没有这个文件的记录，也没有暂存的修改
+    */
+    //清空文件，之后读出的文件头全是默认值
+    void truncate_durable() {
+        ensure_open();
+        if (::ftruncate(fd, 0) != 0 || ::fdatasync(fd) != 0) WriteAheadLog::fail("truncate");
+        info_staged = false;
+        info_changed = false;
+        truncate_staged = false;
     }
+    //让之前用writeT写入的内容落盘
+    void sync_durable() {
+        if (!flush()) WriteAheadLog::fail("sync");
+    }
+    //写入全部文件头
+    void write_all_info_durable(const int tmp[]) {
+        pwrite_all(tmp, info_len * sizeof(int), 0);
+        sync_durable();
+    }
+
     //读出第n个int的值赋给tmp，1_base
     void get_info(int &tmp, int n) {
         if (n > info_len) return;
-        file.open(file_name, std::ios::in | std::ios::binary);
-        file.seekg((n - 1) * sizeof(int));
-        file.read(reinterpret_cast<char *>(&tmp), sizeof(int));
-        file.close();
+        if (info_staged) {
+            tmp = info_buf[n - 1];
+            return;
+        }
+        pread_all(&tmp, sizeof(int), (n - 1) * sizeof(int));
+    }
+
+    //一次读出全部info_len个int
+    void get_all_info(int tmp[]) {
+        if (info_staged) {
+            for (int i = 0; i < info_len; ++i) tmp[i] = info_buf[i];
+            return;
+        }
+        pread_all(tmp, info_len * sizeof(int), 0);
     }
 
     void writeT(T& t, int index) {
-        file.open(file_name, std::ios::in | std::ios::out | std::ios::binary);
-        file.seekp(index);
-        file.write(reinterpret_cast<const char*>(&t), sizeofT);
-        file.close();
+        pwrite_all(&t, sizeofT, index);
     }
 
     //将tmp写入第n个int的位置，1_base
     void write_info(int tmp, int n) {
         if (n > info_len) return;
-        file.open(file_name, std::ios::in | std::ios::out | std::ios::binary);
-        file.seekp((n - 1) * sizeof(int));
-        file.write(reinterpret_cast<const char *>(&tmp), sizeof(int));
-        file.close();
+        if (wal) {
+            stage_info();
+            info_buf[n - 1] = tmp;
+            info_changed = true;
+            return;
+        }
+        pwrite_all(&tmp, sizeof(int), (n - 1) * sizeof(int));
+    }
+
+    //一次写入全部info_len个int
+    void write_all_info(const int tmp[]) {
+        if (wal) {
+            for (int i = 0; i < info_len; ++i) info_buf[i] = tmp[i];
+            info_staged = true;
+            info_changed = true;
+            return;
+        }
+        pwrite_all(tmp, info_len * sizeof(int), 0);
     }
 
     //在文件合适位置写入类对象t，并返回写入的位置索引index
     //位置索引意味着当输入正确的位置索引index，在以下三个函数中都能顺利的找到目标对象进行操作
     //位置索引index可以取为对象写入的起始位置
     int write(T &t) {
-        file.open(file_name, std::ios::in | std::ios::out | std::ios::binary);
-        file.seekp(0, std::ios::end);
-        int index = file.tellp();
-        file.write(reinterpret_cast<const char *>(&t), sizeofT);
-        file.close();
+        ensure_open();
+        struct stat st;
+        ::fstat(fd, &st);
+        int index = st.st_size;
+        pwrite_all(&t, sizeofT, index);
         return index;
     }
 
     //用t的值更新位置索引index对应的对象，保证调用的index都是由write函数产生
     void update(T &t, const int index) {
-        file.open(file_name, std::ios::in | std::ios::out | std::ios::binary);
-        file.seekp(index);
-        file.write(reinterpret_cast<const char *>(&t), sizeofT);
-        file.close();
+        pwrite_all(&t, sizeofT, index);
     }
 
     //读出位置索引index对应的T对象的值并赋值给t，保证调用的index都是由write函数产生
     void read(T &t, const int index) {
-        file.open(file_name, std::ios::in | std::ios::binary);
-        file.seekg(index);
-        file.read(reinterpret_cast<char *>(&t), sizeofT);
-        file.close();
+        pread_all(&t, sizeofT, index);
+    }
+
+    //提示内核异步读入位置索引index对应的对象，之后读取时不用等磁盘
+    void prefetch(const int index) {
+        ensure_open();
+        ::posix_fadvise(fd, index, sizeofT, POSIX_FADV_WILLNEED);
+    }
+
+    //只在数据已经在内核缓冲中时读出位置pos开始的len个字节，需要等磁盘时不读并返回false
+    bool read_cached(void *buf, size_t len, off_t pos) {
+#ifdef RWF_NOWAIT
+        ensure_open();
+        iovec iov{buf, len};
+        return ::preadv2(fd, &iov, 1, pos, RWF_NOWAIT) == (ssize_t)len;
+#else
+        return false;
+#endif
     }
 
     //删除位置索引index对应的对象(不涉及空间回收时，可忽略此函数)，保证调用的index都是由write函数产生
     void Delete(int index) {
         T empty{};
-        file.open(file_name, std::ios::in | std::ios::out | std::ios::binary);
-        file.seekp(index);
-        file.write(reinterpret_cast<const char *>(&empty), sizeofT);
-        file.close();
+        pwrite_all(&empty, sizeofT, index);
     }
 };
 
 
-#endif //BPT_MEMORYRIVER_HPP
\ No newline at end of file
+#endif //BPT_MEMORYRIVER_HPP
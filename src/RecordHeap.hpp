@@ -0,0 +1,169 @@
+#ifndef RECORD_HEAP_HPP
+#define RECORD_HEAP_HPP
+#include "MemoryRiver.hpp"
+#include "BufferPool.hpp"
+
+/*
+记录槽：空闲时用next_free串成空闲链表
+*/
+template<class T>
+struct HeapSlot {
+  T value;
+  int next_free = -1;
+};
+
+/*
+记录堆：把定长记录存放在独立的文件中，用记录在文件中的位置rid引用
+删除的槽放进空闲链表，之后分配时复用
+文件头的两个int依次为write_offset和free_head
+不加锁，只能单线程使用
+*/
+template<class T, int cache_size, template<class> class Policy = LRUPolicy>
+class RecordHeap {
+private:
+  MemoryRiver<HeapSlot<T>, 2> HeapFile;
+  WriteAheadLog* wal;
+  int write_offset;
+  int free_head;
+
+  //第一个槽的偏移量，按槽的对齐要求对齐
+  static constexpr int slot_begin = (2 * sizeof(int) + alignof(HeapSlot<T>) - 1)
+                                    / alignof(HeapSlot<T>) * alignof(HeapSlot<T>);
+
+  BufferPool<HeapSlot<T>, 2, cache_size, Policy> cache;
+
+  void updateInfo() {
+    int info[2] = {write_offset, free_head};
+    HeapFile.write_all_info(info);
+  }
+
+public:
+  using Handle = typename BufferPool<HeapSlot<T>, 2, cache_size, Policy>::Handle;
+
+  //传入wal时堆文件的修改都写进日志
+  RecordHeap(string filename, WriteAheadLog* _wal = nullptr) :
+  HeapFile(filename), wal(_wal), write_offset(slot_begin), free_head(-1), cache(HeapFile) {
+    if (!HeapFile.open()) {
+      HeapFile.initialise();
+      updateInfo();
+    } else {
+      int info[2] = {slot_begin, -1};
+      HeapFile.get_all_info(info);
+      write_offset = info[0];
+      free_head = info[1];
+    }
+    if (wal) {
+      HeapFile.attach(wal);
+      cache.attach(wal);
+    }
+  }
+
+  ~RecordHeap() {
+    cache.flush();
+    cache.drop();
+    HeapFile.close();
+  }
+
+  //存入一条记录，返回它的rid
+  int alloc(const T& value) {
+    int rid;
+    Handle slot;
+    if (free_head != -1) {
+      rid = free_head;
+      slot = cache.pin(rid);
+      free_head = slot->next_free;
+    } else {
+      rid = write_offset;
+      write_offset += sizeof(HeapSlot<T>);
+      slot = cache.create(rid);
+    }
+    slot->value = value;
+    slot->next_free = -1;
+    slot.markDirty();
+    updateInfo();
+    return rid;
+  }
+
+  //pin住rid处的记录，可以通过句柄原地修改，修改后需要markDirty()
+  Handle pin(int rid) {
+    return cache.pin(rid);
+  }
+
+  //提示预读rid处的记录，接下来要按顺序读一批记录时先对每条调用一次
+  void prefetch(int rid) {
+    cache.prefetch(rid);
+  }
+
+  void read(T& value, int rid) {
+    Handle slot = cache.pin(rid);
+    value = slot->value;
+  }
+
+  void update(const T& value, int rid) {
+    Handle slot = cache.pin(rid);
+    slot->value = value;
+    slot.markDirty();
+  }
+
+  //释放rid处的记录
+  void free(int rid) {
+    Handle slot = cache.pin(rid);
+    slot->next_free = free_head;
+    slot.markDirty();
+    free_head = rid;
+    updateInfo();
+  }
+
+  //清空全部记录并截断文件
+  void clear() {
+    cache.drop();
+    HeapFile.clear();
+    write_offset = slot_begin;
+    free_head = -1;
+    updateInfo();
+  }
+
+  //清空之后把values依次写进连续的槽中，第i条记录的rid存进rids[i]
+  //不经过缓存顺序写入，接入日志时先让日志做检查点，槽不写日志，全部落盘之后最后写文件头
+  void load(const sjtu::vector<T>& values, sjtu::vector<int>& rids) {
+    cache.drop();
+    if (wal) {
+      wal->drain();
+      HeapFile.truncate_durable();
+    } else {
+      HeapFile.clear();
+    }
+    free_head = -1;
+    write_offset = slot_begin;
+    HeapSlot<T> slot;
+    for (size_t i = 0; i < values.size(); ++i) {
+      slot.value = values[i];
+      HeapFile.writeT(slot, write_offset);
+      rids.push_back(write_offset);
+      write_offset += sizeof(HeapSlot<T>);
+    }
+    if (!wal) {
+      updateInfo();
+      return;
+    }
+    HeapFile.sync_durable();
+    int info[2] = {write_offset, free_head};
+    HeapFile.write_all_info_durable(info);
+  }
+
+  void flush() {
+    cache.flush();
+    HeapFile.flush();
+  }
+
+  //开启堆文件缓存的后台写回，见BufferPool::start_writer
+  void start_writer(int pages_per_second) {
+    cache.start_writer(pages_per_second);
+  }
+
+  PoolStats cache_stats() const {
+    return cache.stats();
+  }
+};
+
+#endif
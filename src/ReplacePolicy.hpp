@@ -0,0 +1,311 @@
+#ifndef REPLACE_POLICY_HPP
+#define REPLACE_POLICY_HPP
+
+/*
+BufferPool的换出策略，模板参数Frame是缓存页，策略只用到其中的
+index、pin_count、prev、next、ref、queue几个字段
+每个策略提供：
+  admit(f)   新读入的页
+  access(f)  命中已经缓存的页
+  victim()   选出一个没有被pin住的页并从策略中摘下，全部被pin住时返回nullptr
+  clear()    丢弃全部页
+*/
+
+/*
+侵入式双向链表，头部是最近放进来的页
+*/
+template<class Frame>
+struct FrameList {
+  Frame* head = nullptr;
+  Frame* tail = nullptr;
+  int size = 0;
+
+  void push_front(Frame* f) {
+    f->prev = nullptr;
+    f->next = head;
+    if (head) head->prev = f;
+    head = f;
+    if (!tail) tail = f;
+    ++size;
+  }
+
+  void push_back(Frame* f) {
+    f->next = nullptr;
+    f->prev = tail;
+    if (tail) tail->next = f;
+    tail = f;
+    if (!head) head = f;
+    ++size;
+  }
+
+  //把f插到pos的前面
+  void insert_before(Frame* pos, Frame* f) {
+    if (pos == head) {
+      push_front(f);
+      return;
+    }
+    f->prev = pos->prev;
+    f->next = pos;
+    pos->prev->next = f;
+    pos->prev = f;
+    ++size;
+  }
+
+  void remove(Frame* f) {
+    if (f->prev) f->prev->next = f->next;
+    else head = f->next;
+    if (f->next) f->next->prev = f->prev;
+    else tail = f->prev;
+    f->prev = f->next = nullptr;
+    --size;
+  }
+
+  void move_to_front(Frame* f) {
+    if (f == head) return;
+    remove(f);
+    push_front(f);
+  }
+
+  //从尾部往前第一个没有被pin住的页
+  Frame* last_unpinned() const {
+    Frame* cur = tail;
+    while (cur && cur->pin_count > 0) cur = cur->prev;
+    return cur;
+  }
+
+  void clear() {
+    head = tail = nullptr;
+    size = 0;
+  }
+};
+
+/*
+LRU：命中时移到表头，换出表尾
+*/
+template<class Frame>
+class LRUPolicy {
+private:
+  FrameList<Frame> list;
+
+public:
+  explicit LRUPolicy(int) {}
+
+  void admit(Frame* f) {
+    list.push_front(f);
+  }
+  void access(Frame* f) {
+    list.move_to_front(f);
+  }
+  Frame* victim() {
+    Frame* old = list.last_unpinned();
+    if (old) list.remove(old);
+    return old;
+  }
+  void clear() {
+    list.clear();
+  }
+};
+
+/*
+CLOCK：命中只置引用位，指针转一圈把引用位清零，换出第一个引用位为0的页
+*/
+template<class Frame>
+class ClockPolicy {
+private:
+  FrameList<Frame> ring;            //从hand往next方向走，到尾部后回到头部
+  Frame* hand = nullptr;
+
+  Frame* advance(Frame* f) const {
+    return f->next ? f->next : ring.head;
+  }
+
+public:
+  explicit ClockPolicy(int) {}
+
+  //新页放在指针的前面，要转一圈才会再次被检查
+  void admit(Frame* f) {
+    f->ref = false;
+    if (!hand || hand == ring.head) {
+      ring.push_back(f);
+      if (!hand) hand = f;
+      return;
+    }
+    ring.insert_before(hand, f);
+  }
+  void access(Frame* f) {
+    f->ref = true;
+  }
+  Frame* victim() {
+    //两圈之内一定能找到，否则全部被pin住
+    for (int step = 0; hand && step < 2 * ring.size; ++step) {
+      Frame* cur = hand;
+      hand = advance(cur);
+      if (cur->pin_count > 0) continue;
+      if (cur->ref) {
+        cur->ref = false;
+        continue;
+      }
+      ring.remove(cur);
+      if (ring.size == 0) hand = nullptr;
+      return cur;
+    }
+    return nullptr;
+  }
+  void clear() {
+    ring.clear();
+    hand = nullptr;
+  }
+};
+
+/*
+简化的2Q：新页先进入FIFO队列A1，在A1中再次命中时才移进LRU队列Am
+只访问一次的页（比如遍历叶子链表时经过的叶子）留在A1中最先被换出，不会挤掉Am中的根和内部节点
+A1超过容量的1/4时优先从A1换出
+*/
+template<class Frame>
+class TwoQueuePolicy {
+private:
+  enum { A1 = 0, AM = 1 };
+  FrameList<Frame> a1;
+  FrameList<Frame> am;
+  int a1_max;
+
+public:
+  explicit TwoQueuePolicy(int capacity) : a1_max(capacity / 4 > 0 ? capacity / 4 : 1) {}
+
+  void admit(Frame* f) {
+    f->queue = A1;
+    a1.push_front(f);
+  }
+  void access(Frame* f) {
+    if (f->queue == AM) {
+      am.move_to_front(f);
+      return;
+    }
+    a1.remove(f);
+    f->queue = AM;
+    am.push_front(f);
+  }
+  Frame* victim() {
+    Frame* old = nullptr;
+    if (a1.size > a1_max || am.size == 0) {
+      old = a1.last_unpinned();
+      if (!old) old = am.last_unpinned();
+    } else {
+      old = am.last_unpinned();
+      if (!old) old = a1.last_unpinned();
+    }
+    if (old) (old->queue == AM ? am : a1).remove(old);
+    return old;
+  }
+  void clear() {
+    a1.clear();
+    am.clear();
+  }
+};
+
+/*
+页访问频率的估计：4行4位计数器的Count-Min Sketch
+计数器总增量达到一定次数后全部减半，让过去的访问逐渐失效
+*/
+class FrequencySketch {
+private:
+  unsigned char* table;
+  int width;                        //每行的计数器个数，是2的幂
+  int additions = 0;
+  int sample_size;
+
+  int slot(int index, int row) const {
+    unsigned int h = (unsigned int)index * 0x9E3779B1u + (unsigned int)row * 0x85EBCA77u;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 13;
+    return row * width + (int)(h & (unsigned int)(width - 1));
+  }
+
+public:
+  explicit FrequencySketch(int capacity) {
+    width = 64;
+    while (width < 8 * capacity) width *= 2;
+    table = new unsigned char[4 * width]();
+    sample_size = 10 * width;
+  }
+  FrequencySketch(const FrequencySketch&) = delete;
+  FrequencySketch& operator=(const FrequencySketch&) = delete;
+  ~FrequencySketch() {
+    delete[] table;
+  }
+
+  void increment(int index) {
+    for (int row = 0; row < 4; ++row) {
+      unsigned char& counter = table[slot(index, row)];
+      if (counter < 15) ++counter;
+    }
+    if (++additions >= sample_size) {
+      for (int i = 0; i < 4 * width; ++i) table[i] >>= 1;
+      additions /= 2;
+    }
+  }
+
+  int frequency(int index) const {
+    int res = 15;
+    for (int row = 0; row < 4; ++row) {
+      int counter = table[slot(index, row)];
+      if (counter < res) res = counter;
+    }
+    return res;
+  }
+};
+
+/*
+带频率准入的LRU(TinyLFU)：缓存满时新页只有比主队列的换出候选访问得更频繁才能进入主队列
+没能进入的页放在试用队列中，下次换出时最先被换掉，在试用期间再次命中才进入主队列
+*/
+template<class Frame>
+class TinyLFUPolicy {
+private:
+  enum { MAIN = 0, PROBATION = 1 };
+  FrameList<Frame> main;
+  FrameList<Frame> probation;
+  FrequencySketch sketch;
+  int capacity;
+
+public:
+  explicit TinyLFUPolicy(int _capacity) : sketch(_capacity), capacity(_capacity) {}
+
+  void admit(Frame* f) {
+    sketch.increment(f->index);
+    Frame* candidate = main.last_unpinned();
+    //算上f之后缓存已满，说明刚刚为它换出了一页
+    if (main.size + probation.size + 1 >= capacity && candidate &&
+        sketch.frequency(f->index) <= sketch.frequency(candidate->index)) {
+      f->queue = PROBATION;
+      probation.push_front(f);
+      return;
+    }
+    f->queue = MAIN;
+    main.push_front(f);
+  }
+  void access(Frame* f) {
+    sketch.increment(f->index);
+    if (f->queue == MAIN) {
+      main.move_to_front(f);
+      return;
+    }
+    probation.remove(f);
+    f->queue = MAIN;
+    main.push_front(f);
+  }
+  Frame* victim() {
+    Frame* old = probation.last_unpinned();
+    if (!old) old = main.last_unpinned();
+    if (old) (old->queue == MAIN ? main : probation).remove(old);
+    return old;
+  }
+  void clear() {
+    main.clear();
+    probation.clear();
+  }
+};
+
+#endif
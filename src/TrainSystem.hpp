@@ -35,13 +35,6 @@ struct Time {
   bool operator !=(const Time& other) const {
     return (hour != other.hour || minute != other.minute);
   }
-  Time& operator=(const Time& other) {
-    if (this != &other) {
-      hour = other.hour;
-      minute = other.minute;
-    }
-    return *this;
-  }
   friend std::ostream& operator<<(std::ostream& os, const Time& t) {
     os << (t.hour < 10 ? "0" : "") << t.hour << ":"
        << (t.minute < 10 ? "0" : "") << t.minute;
@@ -549,6 +542,32 @@ struct ID_pos {
   }
 };
 
+//station_train_map的内部节点只需要车次作为分隔键
+template<>
+struct SortKey<ID_pos> {
+  using type = TrainID;
+  static const TrainID& get(const ID_pos& id_pos) {
+    return id_pos.trainID;
+  }
+};
+
+//trainDB和orderDB的value放在堆文件中，叶子里只保留参与比较的字段
+template<>
+struct SortKey<Train> {
+  using type = TrainID;
+  static TrainID get(const Train& train) {
+    return TrainID(train.trainID);
+  }
+};
+
+template<>
+struct SortKey<Order> {
+  using type = int;
+  static int get(const Order& order) {
+    return order.ID;
+  }
+};
+
 int binarySearch(const sjtu::vector<ID_pos>& vec, TrainID target) {//从vec中找到这个站是target列车的第几站
   int left = 0;
   int right = vec.size() - 1;
@@ -592,6 +611,9 @@ struct train_date {
 };
 
 
+//候补队列的key为"车次|月|日"，最长ID_len + 6字节，只需要精确查找
+using TrainDateKey = FixedKey<ID_len + 6>;
+
 string traindate_to_string (const train_date& td) {
   string res = td.trainID;
   res = res + '|';
@@ -638,18 +660,25 @@ Date get_startdate(Date date, int delta) {
 
 class TrainSystem {
 private:
-  BPlusTree<Train, 100, 10> trainDB;
-  BPlusTree<Order, 300, 30> orderDB; 
-  BPlusTree<ID_pos, 80, 10> station_train_map;
-  BPlusTree<Order, 300, 30> pending_queue;
+  //trainDB的缓存要能放下常用的车次
+  HeapBPlusTree<Train, 4096, 64, 64, true> trainDB;
+  //orderDB和pending_queue会沿叶子链表连续扫描，用抗扫描的换出策略
+  HeapBPlusTree<Order, 16384, 30, 30, false, Key, TinyLFUPolicy> orderDB;
+  //station_train_map的find_all沿叶子链表扫过一个车站的全部车次，也用抗扫描的策略
+  BPlusTree<ID_pos, 4096, 64, false, Key, TwoQueuePolicy> station_train_map;
+  BPlusTree<Order, 65536, 30, false, TrainDateKey, TwoQueuePolicy> pending_queue;
   string timestamp_file = "timestamp";
 
   long long order_timestamp = 0; // 用于生成订单ID
 public:
   TrainSystem() = default;
   ~TrainSystem() = default;
-  TrainSystem(const string& filename1, const string& filename2, const string& filename3, const string filename4) 
-             : trainDB(filename1), orderDB(filename2), pending_queue(filename3), station_train_map(filename4) {
+  //传入wal时四棵树共用这个写前日志
+  TrainSystem(const string& filename1, const string& filename2, const string& filename3, const string filename4,
+              WriteAheadLog* wal = nullptr)
+             : trainDB(filename1, wal), orderDB(filename2, wal),
+               pending_queue(filename3, wal),
+               station_train_map(filename4, wal) {
                fstream file(timestamp_file, ios::in | ios::out | ios::binary);
                if (!file.is_open()) {
                  file.open(timestamp_file, ios::out | ios::binary);
@@ -665,6 +694,10 @@ public:
                const int travelTimes[], 
                const int stopoverTimes[], 
                Period saleDate, char type) {
+    if (!fits_key(trainID, ID_len)) return -1;
+    for (int i = 0; i < stationNum; ++i) {
+      if (!fits_key(stations[i], station_name_len)) return -1;
+    }
     //cout << "Adding train: " << trainID << endl;
     //for (int i = 0; i < stationNum; ++i) {
     //  cout << "prices[" << i << "] = " << prices[i] << endl;
@@ -675,12 +708,13 @@ public:
     strncpy(newTrain.trainID, trainID.c_str(), ID_len);
     newTrain.trainID[ID_len] = '\0';
     newTrain.stationNum = stationNum;
+    sjtu::vector<KeyValue<ID_pos>> station_entries;
     for (int i = 0; i < stationNum; ++i) {
       strncpy(newTrain.stations[i], stations[i].c_str(), station_name_len);
       newTrain.stations[i][station_name_len] = '\0';
       TrainID tempValue = TrainID(newTrain.trainID);
       ID_pos tempv = ID_pos(tempValue, i);
-      station_train_map.insert(Key(stations[i].c_str()), tempv);
+      station_entries.push_back(KeyValue<ID_pos>(Key(stations[i].c_str()), tempv));
       //cout << "insert: " << stations[i] << " " << tempValue.trainID << " " << i << endl;
       //cout << "insert station_train_map: " << newTrain.stations[i] 
       //     << " -> " << newTrain.trainID << endl;
@@ -722,11 +756,11 @@ public:
     }
     newTrain.saleDate = saleDate;
     newTrain.type = type;
-    if (!trainDB.find_all(Key(trainID.c_str())).empty()) {
-      //cout << "already have train: " << trainDB.find_all(Key(trainID.c_str()))[0].seatNum << trainDB.find_all(Key(trainID.c_str()))[0].trainID << trainDB.find_all(Key(trainID.c_str()))[0].startTime << endl;
+    //trainDB的插入兼做重复检查，车次已经存在时不能留下这次的站点索引
+    if (!trainDB.insert(Key(trainID.c_str()), newTrain)) {
       return -1;
     }
-    trainDB.insert(Key(trainID.c_str()), newTrain);
+    station_train_map.insert_batch(station_entries);
     //cout << newTrain << endl;
     //for (int i = 0; i < newTrain.stationNum; ++i) {
     //  cout << "prices_sum[" << i << "] = " << newTrain.prices_sum[i] << endl;
@@ -745,40 +779,46 @@ public:
   }
 
   int releaseTrain(string& trainID) {
-    Train train = trainDB.find_all(Key(trainID.c_str()))[0];
-    if (train.if_release) {
+    if (!fits_key(trainID, ID_len)) return -1;
+    Key key(trainID.c_str());
+    auto it = trainDB.find_one(key);
+    if (!it.valid() || it.value().if_release) {
       return -1;
     }
-    trainDB.erase_without_merge(Key(trainID.c_str()), train);
-    train.if_release = true;
-    trainDB.insert(Key(trainID.c_str()), train);
+    trainDB.update(key, it.value(), [](Train& t) { t.if_release = true; });
     return 0;
   }
 
   int deleteTrain(string& trainID) {
+    if (!fits_key(trainID, ID_len)) return -1;
     Key key(trainID.c_str());
-    auto temp = trainDB.find_all(key);
-    if (temp.empty()) return -1;
-    Train train = temp[0];
+    Train train;
+    if (!trainDB.find_one(key, train)) return -1;
     if (train.if_release) return -1;
     trainDB.erase(key, train);
+    sjtu::vector<KeyValue<ID_pos>> station_entries;
     for (int i = 0; i < train.stationNum; ++i) {
-      station_train_map.erase(Key(train.stations[i]), ID_pos(TrainID(train.trainID), i));
+      station_entries.push_back(KeyValue<ID_pos>(Key(train.stations[i]), ID_pos(TrainID(train.trainID), i)));
     }
+    station_train_map.erase_batch(station_entries);
     return 0;
   }
 
   void queryTrain(string& trainID, Date& date) {
-    auto results = trainDB.find_all(Key(trainID.c_str()));
-    if (results.empty()) {
+    if (!fits_key(trainID, ID_len)) {
+      cout << -1 << endl;
+      return;
+    }
+    auto result = trainDB.find_one(Key(trainID.c_str()));
+    if (!result.valid()) {
       cout << -1 << endl;
       return;
     }
-    if (date < results[0].saleDate.startTime || date > results[0].saleDate.endTime) {
+    const Train& train = result.value();
+    if (date < train.saleDate.startTime || date > train.saleDate.endTime) {
       cout << -1 << endl;
       return;
     }
-    Train train = results[0];
     cout << train.trainID << " "
          << train.type << endl;
     int cur_seat = train.seatNum;
@@ -809,27 +849,38 @@ public:
   void query_ticket(string& start_station, string& end_station, Date& date, int type) {
     //cout << "query ticket" << endl;
     int total = 0;
+    //超长的站名不可能存在
+    if (!fits_key(start_station, station_name_len) || !fits_key(end_station, station_name_len)) {
+      cout << 0 << endl;
+      return;
+    }
     if (type == 0) {
       sjtu::map<brief_train_info, bool, CompByPrice> result_map;
-      auto start_train = station_train_map.find_all(Key(start_station.c_str()));
-      auto end_train = station_train_map.find_all(Key(end_station.c_str()));
-      if (start_train.size() == 0 || end_train.size() == 0) {
+      Key start_key(start_station.c_str()), end_key(end_station.c_str());
+      auto start_it = station_train_map.lower_bound(start_key);
+      auto end_it = station_train_map.lower_bound(end_key);
+      if (!start_it.valid() || start_it.key() != start_key || !end_it.valid() || end_it.key() != end_key) {
         cout << 0 << endl;
         return;
       }
-      for (int i = 0; i < start_train.size(); ++i) {
+      for (; start_it.valid() && start_it.key() == start_key; start_it.next()) {
         int start_id = -1, end_id = -1;
-        string trainID = start_train[i].trainID.trainID;
-        start_id = start_train[i].pos;
+        const ID_pos& start_pos = start_it.value();
+        string trainID = start_pos.trainID.trainID;
+        start_id = start_pos.pos;
         //cout << "checking train: " << trainID << endl;
-        auto x = trainDB.find_all(Key(trainID.c_str()));
-        if (x.empty()) {
+        auto x = trainDB.find_one(Key(trainID.c_str()));
+        if (!x.valid()) {
           //cout << "train not found in trainDB" << endl;
           continue;
         }
-        Train train = x[0];
+        const Train& train = x.value();
         if (!train.if_release) continue;
-        end_id = binarySearch(end_train, start_train[i].trainID);
+        //两个站的车次都按trainID排好序，end_it跟着start_it单调向前
+        while (end_it.valid() && end_it.key() == end_key && end_it.value().trainID < start_pos.trainID) end_it.next();
+        if (end_it.valid() && end_it.key() == end_key && end_it.value().trainID == start_pos.trainID) {
+          end_id = end_it.value().pos;
+        }
         if (start_id == -1 || end_id == -1 || start_id >= end_id || train.stations[start_id] != start_station || train.stations[end_id] != end_station) {
           //cout << "didn't find end station" << endl;
           continue;
@@ -869,25 +920,31 @@ public:
       }
     } else if (type == 1) {
       sjtu::map<brief_train_info, bool, CompByTime> result_map;
-      auto start_train = station_train_map.find_all(Key(start_station.c_str()));
-      auto end_train = station_train_map.find_all(Key(end_station.c_str()));
-      if (start_train.size() == 0 || end_train.size() == 0) {
+      Key start_key(start_station.c_str()), end_key(end_station.c_str());
+      auto start_it = station_train_map.lower_bound(start_key);
+      auto end_it = station_train_map.lower_bound(end_key);
+      if (!start_it.valid() || start_it.key() != start_key || !end_it.valid() || end_it.key() != end_key) {
         cout << 0 << endl;
         return;
       }
-      for (int i = 0; i < start_train.size(); ++i) {
+      for (; start_it.valid() && start_it.key() == start_key; start_it.next()) {
         int start_id = -1, end_id = -1;
-        string trainID = start_train[i].trainID.trainID;
-        start_id = start_train[i].pos;
+        const ID_pos& start_pos = start_it.value();
+        string trainID = start_pos.trainID.trainID;
+        start_id = start_pos.pos;
         //cout << "checking train: " << trainID << endl;
-        auto x = trainDB.find_all(Key(trainID.c_str()));
-        if (x.empty()) {
+        auto x = trainDB.find_one(Key(trainID.c_str()));
+        if (!x.valid()) {
           //cout << "train not found in trainDB" << endl;
           continue;
         }
-        Train train = x[0];
+        const Train& train = x.value();
         if (!train.if_release) continue;
-        end_id = binarySearch(end_train, start_train[i].trainID);
+        //两个站的车次都按trainID排好序，end_it跟着start_it单调向前
+        while (end_it.valid() && end_it.key() == end_key && end_it.value().trainID < start_pos.trainID) end_it.next();
+        if (end_it.valid() && end_it.key() == end_key && end_it.value().trainID == start_pos.trainID) {
+          end_id = end_it.value().pos;
+        }
         if (start_id == -1 || end_id == -1 || start_id >= end_id || train.stations[start_id] != start_station || train.stations[end_id] != end_station) {
           //cout << "didn't find end station" << endl;
           continue;
@@ -933,6 +990,10 @@ public:
     //HAPPY_TRAIN 中院 08-17 05:24 -> 下院 08-17 15:24 514 1000
     brief_transfer_info result;
     string mid_station;
+    if (!fits_key(start_station, station_name_len) || !fits_key(end_station, station_name_len)) {
+      cout << 0 << endl;
+      return;
+    }
     Date arrive_date = date, mid_date = date, mid_date1 = date;
     auto beg_train = station_train_map.find_all(Key(start_station.c_str()));
     auto end_train = station_train_map.find_all(Key(end_station.c_str()));
@@ -949,12 +1010,12 @@ public:
     bool if_found = false;
     for (int xx = 0; xx < beg_train.size(); ++xx) {
       string trainA_id = beg_train[xx].trainID.trainID;
-      auto x = trainDB.find_all(Key(trainA_id.c_str()));
-      if (x.empty()) {
+      auto x = trainDB.find_one(Key(trainA_id.c_str()));
+      if (!x.valid()) {
         //cout << "train not found in trainDB" << endl;
         continue;
       }
-      Train A = x[0];
+      const Train& A = x.value();
       if (!A.if_release) continue;
       //cout << "checking the first train: " << trainA_id << endl;
       Time depA = A.startTime;
@@ -995,9 +1056,9 @@ public:
             string trainB_id = mid_train[it2].trainID.trainID;
             if (trainB_id == trainA_id) continue;
             if (!if_find(end_train, mid_train[it2].trainID)) continue;
-            auto x = trainDB.find_all(Key(trainB_id.c_str()));
-            if (x.empty()) continue;
-            Train B = x[0];
+            auto y = trainDB.find_one(Key(trainB_id.c_str()));
+            if (!y.valid()) continue;
+            const Train& B = y.value();
             if (!B.if_release) continue;
             //cout << "checking the second train: " << B.trainID << endl;
             int j = -1, end_j = -1;
@@ -1062,7 +1123,8 @@ public:
             Date temp1;
             add_time(temp1, depB, B.arrivetimes[end_j] - B.arrivetimes[j] - B.stopoverTimes[j]);
             Date t = add_days(leave_date, B.dates[end_j] - B.leavedates[j]);
-            int tt = get_time(date, A.startTime, t, depB);
+            Time startA = A.startTime;
+            int tt = get_time(date, startA, t, depB);
             brief_transfer_info info(trainA_id.c_str(), A_leave_time, durationA, priceA, seatA,
                                   trainB_id.c_str(), B_leave_time, durationB, priceB, seatB, depA, depB, tt);
             if (info.price_A == -1 || info.price_B == -1 || info.seat_num_A == -1 || info.seat_num_B == -1) continue;
@@ -1136,13 +1198,12 @@ public:
     //     << start_station << " -> " 
     //     << end_station << " " << num << endl;
     bool if_pending = false;
-    auto x = trainDB.find_all(Key(trainID.c_str()));
-    if (x.empty()) {
+    Train train;
+    if (!fits_key(trainID, ID_len) || !trainDB.find_one(Key(trainID.c_str()), train)) {
       //cout << "train not found in trainDB" << endl;
       cout << -1 << endl;
       return;
     }
-    Train train = x[0];
     if (!train.if_release) {
       cout << -1 << endl;
       return;
@@ -1193,16 +1254,16 @@ public:
                       leaving_time, arriving_time, total_price / num, num, if_pending ? 1 : 0, username.c_str()); 
     Date current_date = date;
     if (!if_pending) {//如果成功购票，要更改火车的信息
-      for (int i = start_id; i < end_id; ++i) {
-        current_date = add_days(date, train.leavedates[i] - train.leavedates[start_id]);
-        train.seat_num[delta_date(current_date)][i] -= num;
-        //cout << "train: " << train.trainID << "station:" << train.stations[i] << ' '
-        //     << "date:" << current_date << " "
-        //     << "delta seat_num: " << num << " " 
-        //     << "cur seat_num: " << train.seat_num[delta_date(current_date)][i] << endl;
-      }
-      trainDB.erase_without_merge(Key(trainID.c_str()), trainDB.find_all(Key(trainID.c_str()))[0]);
-      trainDB.insert(Key(trainID.c_str()), train);
+      trainDB.update(Key(trainID.c_str()), train, [&](Train& t) {
+        for (int i = start_id; i < end_id; ++i) {
+          current_date = add_days(date, t.leavedates[i] - t.leavedates[start_id]);
+          t.seat_num[delta_date(current_date)][i] -= num;
+          //cout << "train: " << t.trainID << "station:" << t.stations[i] << ' '
+          //     << "date:" << current_date << " "
+          //     << "delta seat_num: " << num << " " 
+          //     << "cur seat_num: " << t.seat_num[delta_date(current_date)][i] << endl;
+        }
+      });
       cout << total_price << endl;
       new_order.ID = ++order_timestamp;
       orderDB.insert(Key(username.c_str()), new_order); 
@@ -1224,7 +1285,7 @@ public:
         new_order.ID = ++order_timestamp;
         train_date v = train_date(new_order.trainID, new_order.startDate);
         string KEY = traindate_to_string(v);
-        pending_queue.insert(Key(KEY.c_str()), new_order);
+        pending_queue.insert(TrainDateKey(KEY.c_str()), new_order);
         orderDB.insert(Key(username.c_str()), new_order); 
         //    cout << "order insert" << endl;
         //cout << new_order.trainID << " " 
@@ -1245,14 +1306,17 @@ public:
   }
 
   void query_order(string& username) {//要求用户登录的前提下调用
-    auto orders = orderDB.find_all(Key(username.c_str()));
-    if (orders.empty()) {
+    Key key(username.c_str());
+    int order_num = orderDB.count(key);
+    if (order_num == 0) {
       cout << 0 << endl;
       return;
     }
-    cout << orders.size() << endl;
-    for (int i = orders.size() - 1; i >= 0; --i) {
-      Order& order = orders[i];
+    cout << order_num << endl;
+    //从最新的订单开始倒着遍历
+    auto it = orderDB.upper_bound(key);
+    for (it.prev(); it.valid() && it.key() == key; it.prev()) {
+      const Order& order = it.value();
       cout << '[';
       if (order.status == 0) {
         cout << "success] ";
@@ -1295,9 +1359,8 @@ public:
       return;
     }
     if (order.status == 1) {//如果本来在候补队列中，将状态改变并不做其他任何操作
-      orderDB.erase_without_merge(Key(username.c_str()), order);
+      orderDB.update(Key(username.c_str()), order, [](Order& o) { o.status = 2; });
       order.status = 2;
-      orderDB.insert(Key(username.c_str()), order);
       //      cout << "order insert" << endl;
       //cout << order.trainID << " " 
       //     << order.startStation << " " 
@@ -1311,13 +1374,11 @@ public:
       //     << order.ID
       //     << endl;
       train_date td = train_date(order.trainID, order.date);
-      Key KEY = Key(traindate_to_string(td).c_str());
+      TrainDateKey KEY = TrainDateKey(traindate_to_string(td).c_str());
       auto temp = pending_queue.find_all(KEY);
       for (int i = 0; i < temp.size(); i++) {
         if (temp[i].ID == order.ID) {
-          pending_queue.erase_without_merge(KEY, temp[i]);
-          temp[i].status = 2;
-          pending_queue.insert(KEY, temp[i]);
+          pending_queue.update(KEY, temp[i], [](Order& o) { o.status = 2; });
           break;
         }
       }
@@ -1334,7 +1395,8 @@ public:
     } else if (order.status == 0) {//如果已经成功购票，需要更改火车座位信息
       //cout << "already success" << endl;
       //cout << "refund ticket: " << order.startStation << "->" << order.endStation << "date: " << order.date << endl;
-      Train train = trainDB.find_all(Key(order.trainID))[0];
+      Train train;
+      trainDB.find_one(Key(order.trainID), train);
       int start_id = -1, end_id = -1;
       for (int i = 0; i < train.stationNum; ++i) {
         if (strcmp(train.stations[i], order.startStation) == 0) {
@@ -1349,19 +1411,18 @@ public:
         return;
       }
       Date current_date = order.date;
-      trainDB.erase_without_merge(train.trainID, train);
-      for (int i = start_id; i < end_id; ++i) {
-        current_date = add_days(order.date, train.leavedates[i] - train.leavedates[start_id]);
-        train.seat_num[delta_date(current_date)][i] += order.num;
-        //cout << "train: " << train.trainID << "station:" << train.stations[i] << ' '
-        //     << "date:" << current_date << " "
-        //     << "delta seat_num: " << order.num << " " 
-        //     << "cur seat_num: " << train.seat_num[delta_date(current_date)][i] << endl;
-      }
-      trainDB.insert(train.trainID, train);
-      orderDB.erase_without_merge(Key(username.c_str()), order);
+      trainDB.update(train.trainID, train, [&](Train& t) {
+        for (int i = start_id; i < end_id; ++i) {
+          current_date = add_days(order.date, t.leavedates[i] - t.leavedates[start_id]);
+          t.seat_num[delta_date(current_date)][i] += order.num;
+          //cout << "train: " << t.trainID << "station:" << t.stations[i] << ' '
+          //     << "date:" << current_date << " "
+          //     << "delta seat_num: " << order.num << " " 
+          //     << "cur seat_num: " << t.seat_num[delta_date(current_date)][i] << endl;
+        }
+      });
+      orderDB.update(Key(username.c_str()), order, [](Order& o) { o.status = 2; });
       order.status = 2;
-      orderDB.insert(Key(username.c_str()), order);
       //      cout << "order insert" << endl;
       //cout << order.trainID << " " 
       //     << order.startStation << " " 
@@ -1377,7 +1438,7 @@ public:
 
       //检查pending_queue中是否有候补订单可以完成
       train_date td = train_date(order.trainID, order.startDate);
-      Key KEY = Key(traindate_to_string(td).c_str());
+      TrainDateKey KEY = TrainDateKey(traindate_to_string(td).c_str());
       auto temp = pending_queue.find_all(KEY);
       for (int i = 0; i < temp.size(); ++i) {
         Order pending_order = temp[i];
@@ -1397,7 +1458,8 @@ public:
           continue;
         }
         bool flag = true;
-        Train train = trainDB.find_all(Key(pending_order.trainID))[0];
+        Train train;
+        trainDB.find_one(Key(pending_order.trainID), train);
         int start_id1 = -1, end_id1 = -1;
         for (int j = 0; j < train.stationNum; ++j) {
           if (strcmp(train.stations[j], pending_order.startStation) == 0) {
@@ -1419,10 +1481,9 @@ public:
           }
         }
         if (flag) {
-          orderDB.erase_without_merge(Key(pending_order.userID), pending_order);
+          orderDB.update(Key(pending_order.userID), pending_order, [](Order& o) { o.status = 0; });
           pending_queue.erase(KEY, pending_order);
           pending_order.status = 0;
-          orderDB.insert(Key(pending_order.userID), pending_order);
           //cout << "pending order finished" << endl;
           //cout << pending_order.trainID << " " 
           //     << pending_order.startStation << " " 
@@ -1436,16 +1497,16 @@ public:
           //     << pending_order.ID
           //     << endl;
           current_date1 = pending_order.date;
-          trainDB.erase_without_merge(Key(pending_order.trainID), train);
-          for (int j = start_id1; j < end_id1; ++j) {
-            current_date1 = add_days(pending_order.date, train.leavedates[j] - train.leavedates[start_id1]);
-            train.seat_num[delta_date(current_date1)][j] -= pending_order.num;
-            //cout << "train: " << train.trainID << "station:" << train.stations[i] << ' '
-            //     << "date:" << current_date << " "
-            //     << "delta seat_num: " << order.num << " " 
-            //     << "cur seat_num: " << train.seat_num[delta_date(current_date)][i] << endl;
-          }
-          trainDB.insert(Key(pending_order.trainID), train);
+          trainDB.update(Key(pending_order.trainID), train, [&](Train& t) {
+            for (int j = start_id1; j < end_id1; ++j) {
+              current_date1 = add_days(pending_order.date, t.leavedates[j] - t.leavedates[start_id1]);
+              t.seat_num[delta_date(current_date1)][j] -= pending_order.num;
+              //cout << "train: " << t.trainID << "station:" << t.stations[i] << ' '
+              //     << "date:" << current_date << " "
+              //     << "delta seat_num: " << order.num << " " 
+              //     << "cur seat_num: " << t.seat_num[delta_date(current_date)][i] << endl;
+            }
+          });
         }
       }
       cout << 0 << endl;
@@ -1467,5 +1528,13 @@ public:
       file.close();
     }
   }
+
+  //开启四棵树的后台写回，每秒最多写回pages_per_second页
+  void start_writer(int pages_per_second) {
+    trainDB.start_writer(pages_per_second);
+    orderDB.start_writer(pages_per_second);
+    pending_queue.start_writer(pages_per_second);
+    station_train_map.start_writer(pages_per_second);
+  }
 };
 #endif
\ No newline at end of file
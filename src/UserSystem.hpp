@@ -77,14 +77,23 @@ struct account {
   }
 };
 
+//userDB的内部节点只需要用户名作为分隔键
+template<>
+struct SortKey<account> {
+  using type = Key;
+  static Key get(const account& user) {
+    return Key(user.username);
+  }
+};
+
 class UserSystem {
 private:
-  BPlusTree<account, 100, 20> userDB;
+  BPlusTree<account, 16384, 20, true> userDB;
   int user_num = 0;
   sjtu::map<string, int> login_users;
 public:
   UserSystem() = default;
-  UserSystem(string filename) : userDB(filename) {
+  UserSystem(string filename, WriteAheadLog* wal = nullptr) : userDB(filename, wal) {
     user_num = userDB.get_num();
   };
   ~UserSystem() = default;
@@ -100,12 +109,11 @@ public:
       user_num++;
       return 0;
     } else {
-      auto it = userDB.find_all(Key(username.c_str()));
-      if (!it.empty()) {
+      if (userDB.contains(Key(username.c_str()))) {
         return -1;
       } else {
-        auto cur_it = userDB.find_all(Key(cur_username.c_str()));
-        if (cur_it.empty() || cur_it[0].privilege <= privilege || login_users.find(username) != login_users.end()) {
+        auto cur_it = userDB.find_one(Key(cur_username.c_str()));
+        if (!cur_it.valid() || cur_it.value().privilege <= privilege || login_users.find(username) != login_users.end()) {
           return -1;
         }
         if (login_users.find(cur_username) == login_users.end()) return -1;
@@ -122,19 +130,20 @@ public:
       //cout << "there is no user in the system" << endl;
       return -1;
     }
-    auto it = userDB.find_all(Key(username.c_str()));
-    if (it.empty() || strcmp(it[0].password, password.c_str()) != 0
+    if (!check_username(username.c_str())) return -1;
+    auto it = userDB.find_one(Key(username.c_str()));
+    if (!it.valid() || strcmp(it.value().password, password.c_str()) != 0
         || login_users.find(username) != login_users.end()) {
-      if (it.empty()) {
+      if (!it.valid()) {
         //cout << "user not found" << endl;
-      } else if (strcmp(it[0].password, password.c_str()) != 0) {
+      } else if (strcmp(it.value().password, password.c_str()) != 0) {
         //cout << "password error" << endl;
       } else {
         //cout << "user already logged in" << endl;
       }
       return -1;
     }
-    login_users[username] = it[0].privilege;
+    login_users[username] = it.value().privilege;
     return 0;
   }
 
@@ -159,19 +168,19 @@ public:
     }
     //检查cur的权限是否足够
     if (cur_username != username) {
-      auto it = userDB.find_all(Key(username.c_str()));
-      if (it.empty() || login_users[cur_username] <= it[0].privilege) {
+      auto it = userDB.find_one(Key(username.c_str()));
+      if (!it.valid() || login_users[cur_username] <= it.value().privilege) {
         std::cout << "-1" << std::endl;
         return;
       }
     }
     //查询用户信息
-    auto it = userDB.find_all(Key(username.c_str()));
-    if (it.empty()) {
+    auto it = userDB.find_one(Key(username.c_str()));
+    if (!it.valid()) {
       std::cout << "-1" << std::endl;
       return;
     }
-    const account& user_info = it[0];
+    const account& user_info = it.value();
     std::cout << user_info.username << ' ' 
               << user_info.realname << ' '
               << user_info.mailAddr << ' ' 
@@ -192,25 +201,23 @@ public:
     }
     //检查cur的权限是否足够
     if (cur_username != username) {
-      auto it = userDB.find_all(Key(username.c_str()));
-      if (it.size() == 0 || login_users[cur_username] <= it[0].privilege) {
+      auto it = userDB.find_one(Key(username.c_str()));
+      if (!it.valid() || login_users[cur_username] <= it.value().privilege) {
         std::cout << "-1" << std::endl;
         return;
       }
     }
     //查询用户信息
-    auto it = userDB.find_all(Key(username.c_str()));
-    if (it.empty()) {
+    account user_info;
+    if (!userDB.find_one(Key(username.c_str()), user_info)) {
       std::cout << "-1" << std::endl;
       return;
     }
-    account& user_info = it[0];
-    userDB.erase(Key(username.c_str()), user_info);
     if (password.length() != 0) strncpy(user_info.password, password.c_str(), password_len);
     if (realname.length() != 0) strncpy(user_info.realname, realname.c_str(), realname_len);
     if (mailAddr.length() != 0) strncpy(user_info.mailAddr, mailAddr.c_str(), mailAddr_len);
     if (privilege != -1) user_info.privilege = privilege;
-    userDB.insert(Key(username.c_str()), user_info);
+    userDB.update(Key(username.c_str()), user_info, [&](account& a) { a = user_info; });
     std::cout << user_info.username << ' ' 
               << user_info.realname << ' '
               << user_info.mailAddr << ' ' 
@@ -230,5 +237,10 @@ public:
   void exit() {
     login_users.clear();
   }
+
+  //开启userDB的后台写回，每秒最多写回pages_per_second页
+  void start_writer(int pages_per_second) {
+    userDB.start_writer(pages_per_second);
+  }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,270 @@
+#ifndef WRITE_AHEAD_LOG_HPP
+#define WRITE_AHEAD_LOG_HPP
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "vector.hpp"
+
+using std::string;
+
+class WriteAheadLog;
+
+/*
+参与写前日志的对象：数据文件的文件头(MemoryRiver)和节点缓存(BufferPool)
+提交时先由logChanges把这次提交修改过的内容追加到日志中，日志落盘之后再调用afterCommit
+*/
+class WalParticipant {
+public:
+  virtual ~WalParticipant() = default;
+  //把还没有写进日志的修改追加到wal中
+  virtual void logChanges(WriteAheadLog& wal) = 0;
+  //日志已经落盘，修改过的内容可以写回数据文件了
+  virtual void afterCommit() = 0;
+  //把已经提交的修改全部写回数据文件并落盘，有写失败时返回false
+  virtual bool checkpoint() = 0;
+};
+
+/*
+写前日志：所有数据文件共用一个日志文件，记录修改后的整页镜像(物理重做日志)
+一次提交的记录先攒在内存中，commit时连同COMMIT记录一次写入日志文件，sync时日志落盘
+日志没有落盘的修改不会写回数据文件(节点缓存中的脏页在落盘前一直被pin住)，所以恢复时只需要重做
+启动时把日志中完整提交的记录依次重放到数据文件中，最后一次不完整的提交直接丢弃
+日志超过checkpoint_size时做检查点：写回全部脏页并落盘，然后清空日志
+日志或数据文件写失败时直接终止进程，不再放行修改和输出，重启后恢复到最后一次完整的提交
+
+记录格式：RecordHead，文件名，数据
+  PAGE      把数据写到文件的offset处
+  TRUNCATE  清空文件
+  COMMIT    offset是这次提交全部记录的校验和，len是它们的字节数
+*/
+class WriteAheadLog {
+private:
+  enum RecordType { PAGE = 1, TRUNCATE = 2, COMMIT = 3 };
+  struct RecordHead {
+    int type;
+    int name_len;
+    int offset;
+    int len;
+  };
+
+  string log_name;
+  int fd = -1;
+  string buf;                       //这次提交还没有写入的记录
+  long long log_size = 0;
+  bool unsynced = false;            //有写进日志但还没有落盘的提交
+  long long checkpoint_size;
+  sjtu::vector<WalParticipant*> participants;
+
+  //一次处理8个字节的FNV式校验和，提交的内容可能有几十KB，逐字节算太慢
+  static unsigned int checksum(const char* p, size_t n) {
+    unsigned long long h = 14695981039346656037ull;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      unsigned long long word;
+      std::memcpy(&word, p + i, 8);
+      h = (h ^ word) * 1099511628211ull;
+      h ^= h >> 29;
+    }
+    for (; i < n; ++i) h = (h ^ (unsigned char)p[i]) * 1099511628211ull;
+    return (unsigned int)(h ^ (h >> 32));
+  }
+
+  void append(int type, const string& name, int offset, const void* data, int len) {
+    RecordHead head{type, (int)name.size(), offset, len};
+    buf.append(reinterpret_cast<const char*>(&head), sizeof(head));
+    buf.append(name);
+    if (len > 0) buf.append(reinterpret_cast<const char*>(data), len);
+  }
+
+  //读出pos处的记录头，记录不完整时返回false
+  static bool readHead(const string& log, size_t pos, RecordHead& head) {
+    if (pos + sizeof(RecordHead) > log.size()) return false;
+    log.copy(reinterpret_cast<char*>(&head), sizeof(RecordHead), pos);
+    if (head.name_len < 0 || head.len < 0) return false;
+    if (head.type == COMMIT) return true;
+    if (head.type != PAGE && head.type != TRUNCATE) return false;
+    return pos + sizeof(RecordHead) + head.name_len + head.len <= log.size();
+  }
+
+  //写失败或者写不完时返回false
+  static bool writeAll(int file, const char* p, size_t len, off_t pos) {
+    while (len > 0) {
+      ssize_t n = ::pwrite(file, p, len, pos);
+      if (n <= 0) return false;
+      p += n;
+      pos += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  //把[begin, end)中的记录重放到数据文件中
+  void replay(const string& log, size_t begin, size_t end) {
+    struct OpenFile {
+      string name;
+      int fd;
+    };
+    sjtu::vector<OpenFile> files;
+    for (size_t pos = begin; pos < end;) {
+      RecordHead head;
+      //recover()已经检查过[begin, end)中的记录都是完整的
+      if (!readHead(log, pos, head)) fail("wal replay");
+      if (head.type == COMMIT) {
+        pos += sizeof(head);
+        continue;
+      }
+      string name = log.substr(pos + sizeof(head), head.name_len);
+      const char* data = log.data() + pos + sizeof(head) + head.name_len;
+      pos += sizeof(head) + head.name_len + head.len;
+      int file = -1;
+      for (int i = 0; i < (int)files.size(); ++i) {
+        if (files[i].name == name) file = files[i].fd;
+      }
+      if (file == -1) {
+        file = ::open(name.c_str(), O_RDWR | O_CREAT, 0644);
+        if (file == -1) continue;
+        files.push_back(OpenFile{name, file});
+      }
+      //重放失败时日志还要留着，下次启动再重放
+      if (head.type == TRUNCATE) {
+        if (::ftruncate(file, 0) != 0) fail("wal replay");
+      } else if (!writeAll(file, data, head.len, head.offset)) {
+        fail("wal replay");
+      }
+    }
+    for (int i = 0; i < (int)files.size(); ++i) {
+      if (::fdatasync(files[i].fd) != 0) fail("wal replay");
+      ::close(files[i].fd);
+    }
+  }
+
+  //重做日志中完整提交的部分，然后清空日志
+  void recover() {
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) return;
+    string log(st.st_size, '\0');
+    size_t got = 0;
+    while (got < log.size()) {
+      ssize_t n = ::pread(fd, &log[got], log.size() - got, got);
+      if (n <= 0) break;
+      got += n;
+    }
+    log.resize(got);
+    size_t committed = 0;
+    for (size_t pos = 0;;) {
+      RecordHead head;
+      if (!readHead(log, pos, head)) break;
+      if (head.type != COMMIT) {
+        pos += sizeof(head) + head.name_len + head.len;
+        continue;
+      }
+      if ((size_t)head.len != pos - committed ||
+          (int)checksum(log.data() + committed, head.len) != head.offset) break;
+      pos += sizeof(head);
+      committed = pos;
+    }
+    if (committed > 0) replay(log, 0, committed);
+    if (::ftruncate(fd, 0) != 0 || ::fdatasync(fd) != 0) fail("wal recover");
+  }
+
+public:
+  //日志或数据文件写失败时终止进程，数据文件的写入方也用它
+  static void fail(const char* what) {
+    std::perror(what);
+    std::abort();
+  }
+
+  explicit WriteAheadLog(const string& filename, long long _checkpoint_size = 64ll << 20) :
+  log_name(filename), checkpoint_size(_checkpoint_size) {
+    fd = ::open(log_name.c_str(), O_RDWR | O_CREAT, 0644);
+    recover();
+  }
+
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+  ~WriteAheadLog() {
+    if (fd != -1) ::close(fd);
+  }
+
+  void attach(WalParticipant* p) {
+    participants.push_back(p);
+  }
+
+  void detach(WalParticipant* p) {
+    int n = participants.size();
+    for (int i = 0; i < n; ++i) {
+      if (participants[i] != p) continue;
+      for (int j = i; j + 1 < n; ++j) participants[j] = participants[j + 1];
+      participants.pop_back();
+      return;
+    }
+  }
+
+  //记录文件file在offset处的新内容
+  void logPage(const string& file, int offset, const void* data, int len) {
+    append(PAGE, file, offset, data, len);
+  }
+
+  //记录文件file被清空，必须在这次提交中该文件的其他记录之前
+  void logTruncate(const string& file) {
+    append(TRUNCATE, file, 0, nullptr, 0);
+  }
+
+  //提交之前的全部修改，内容没有变化时不写日志，返回是否写了日志
+  //日志只写进内核缓冲，什么时候落盘由调用者通过sync()决定(见GroupCommit.hpp)，落盘之前修改不会写回数据文件
+  bool commit() {
+    for (int i = 0; i < (int)participants.size(); ++i) participants[i]->logChanges(*this);
+    bool wrote = !buf.empty();
+    if (wrote) {
+      RecordHead head{COMMIT, 0, (int)checksum(buf.data(), buf.size()), (int)buf.size()};
+      buf.append(reinterpret_cast<const char*>(&head), sizeof(head));
+      if (!writeAll(fd, buf.data(), buf.size(), log_size)) fail("wal commit");
+      log_size += buf.size();
+      buf.clear();
+      unsynced = true;
+    }
+    return wrote;
+  }
+
+  //让已经写入的日志落盘，然后放行这些提交的修改
+  void sync() {
+    if (unsynced && ::fdatasync(fd) != 0) fail("wal sync");
+    unsynced = false;
+    apply();
+  }
+
+  //不等日志落盘就放行已经提交的修改，断电时数据文件可能比日志新，只用于Durability::None
+  void apply() {
+    for (int i = 0; i < (int)participants.size(); ++i) participants[i]->afterCommit();
+    if (log_size >= checkpoint_size) checkpoint();
+  }
+
+  //写回全部已提交的修改并落盘，之后日志就不再需要了，只能在sync()或apply()之后调用
+  void checkpoint() {
+    //数据文件没有全部落盘时日志不能清空
+    for (int i = 0; i < (int)participants.size(); ++i) {
+      if (!participants[i]->checkpoint()) fail("wal checkpoint");
+    }
+    if (::ftruncate(fd, 0) != 0 || ::fdatasync(fd) != 0) fail("wal checkpoint");
+    log_size = 0;
+  }
+
+  //提交并落盘之前的全部修改，再做检查点，之后数据文件就是最新的，日志中没有任何记录
+  //批量载入在这之后可以不经过日志直接写数据文件(见BPlusTree::bulk_load)
+  void drain() {
+    commit();
+    sync();
+    checkpoint();
+  }
+
+  long long size() const {
+    return log_size;
+  }
+};
+
+#endif
@@ -4,6 +4,12 @@
 #include <cstring>
 using std::string;
 
+//用户名、车次和站名都用作B+树的key，超长时Key只能截断，前缀相同的两个会变成同一个key
+//Release构建中Key里的assert不起作用，所以在命令入口检查长度，超长直接拒绝
+bool fits_key(const string& str, int max_len) {
+  return str.size() <= (size_t)max_len;
+}
+
 bool checkchinese(const char* str) {
   if (str == nullptr) return false;
   int len = strlen(str);